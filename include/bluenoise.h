@@ -0,0 +1,32 @@
+#ifndef BLUENOISE_H
+#define BLUENOISE_H
+#endif
+
+// Side of the square mask, which is tiled across the image, and the width of
+// the Gaussian the void-and-cluster energy is measured with
+#define BLUE_NOISE_SIZE 64
+#define BLUE_NOISE_SIGMA 1.5
+
+//*****************************************************************************
+// BlueNoise
+//*****************************************************************************
+
+// A tileable blue-noise threshold mask, made with Ulichney's void-and-cluster
+// method. Every value in [0, 1) appears once, and neighbouring pixels get
+// values that are far apart, so an offset read from it per pixel spreads the
+// sampling error into high frequencies the eye barely sees.
+
+class BlueNoise {
+
+  public:
+
+    // Declarations
+    static float* mask;
+
+    // Methods
+    static void generate();
+    static float value(int x, int y);
+
+    static void dispose();
+
+};
@@ -27,7 +27,13 @@ class BoundingBox {
     float z_max;
 
     // Methods
-    bool intersect(Ray ray);
+    bool intersect(const Ray& ray);
+    bool intersect(const Ray& ray, float* t_entry);
+    void reset();
+    void expand(BoundingBox* other);
+    void expand(Vector point);
+    Vector centroid();
+    float surface_area();
     static void print(BoundingBox* bbox);
 
 };
\ No newline at end of file
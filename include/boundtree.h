@@ -2,6 +2,7 @@
 #define BOUNDTREE_H
 #endif
 
+#include <string>
 #include <vector>
 
 #ifndef BOUNDING_H
@@ -16,39 +17,185 @@
 #include "shape.h"
 #endif
 
+#ifndef HITRECORD_H
+#include "hitrecord.h"
+#endif
+
+#ifndef PRIMITIVE_H
+#include "primitive.h"
+#endif
+
+// Surface area heuristic parameters
+#define SAH_BINS 16
+#define SAH_TRAVERSAL_COST 1.0
+#define SAH_INTERSECT_COST 1.0
+
+// Leaves record their shape count in 16 bits
+#define BVH_MAX_LEAF_SIZE 65535
+
+// Parallel construction: subtrees above BUILD_TASK_THRESHOLD shapes become
+// tasks, and ranges above BUILD_PARALLEL_THRESHOLD are bounded and binned in
+// BUILD_CHUNKS pieces at once
+#define BUILD_TASK_THRESHOLD 1024
+#define BUILD_PARALLEL_THRESHOLD 16384
+#define BUILD_CHUNKS 16
+
+// Deepest tree the builders make. Past BVH_SAH_MAX_DEPTH the SAH builder
+// splits at the object median instead, which halves the range every level,
+// so no int count of primitives can then go more than 31 levels further.
+// The traversal stack also has room for a mesh's tree under a leaf of the
+// scene's.
+#define BVH_MAX_DEPTH 64
+#define BVH_SAH_MAX_DEPTH 32
+#define BVH_STACK_SIZE (2 * BVH_MAX_DEPTH)
+
 //*****************************************************************************
-// BoundingTree
+// LinearNode
 //*****************************************************************************
 
-class BoundingTree {
+// One node of the flattened tree, packed into 32 bytes. Nodes are stored in
+// depth-first order, so an interior node's first child directly follows it.
+
+class LinearNode {
+
+  public:
+
+    // Declarations
+    BoundingBox bbox;
+    int offset;                   // First primitive (leaf) or second child
+    unsigned short shape_count;   // Primitives in a leaf, 0 for interior nodes
+    unsigned char axis;
+    unsigned char pad;
+
+};
+
+//*****************************************************************************
+// PrimitiveInfo
+//*****************************************************************************
+
+class BoundingTree;
+class WideTree;
+class TriangleBlocks;
+class TriangleMesh;
+
+// What the builders sort: a primitive, its bounds, and its position in the
+// list of every primitive in the scene. A whole mesh is sorted as one of
+// these too, standing in for the tree over its faces.
+
+class PrimitiveInfo {
+
+  public:
+
+    // Declarations
+    BoundingBox bbox;
+    Primitive primitive;
+    int id;
+    BoundingTree* subtree;    // The mesh's tree, or NULL for a primitive
+
+};
+
+//*****************************************************************************
+// BuildNode
+//*****************************************************************************
+
+// A node of the tree while it is being built, before flatten() copies it
+// into the node array. Plain data, so the builders can hand out 2n - 1 of
+// them from one allocation without constructing anything.
+
+class BuildNode {
 
   public:
 
     // Declarations
-    bool leaf;
-    Shape* shape;
     BoundingBox bbox;
-    BoundingTree* left_child;
-    BoundingTree* right_child;
+    BuildNode* left_child;
+    BuildNode* right_child;
+    int first_shape;
+    int shape_count;
+    int split_axis;
+    bool leaf;
+
+};
+
+//*****************************************************************************
+// BoundingTree
+//*****************************************************************************
+
+class BoundingTree {
+
+  public:
+
+    // Build methods
+    static const int MEDIAN = 0;
+    static const int SAH = 1;
+
+    static int method;
+    static int leaf_size;
+    static int width;
+
+    // Flattened tree, filled in by flatten()
+    LinearNode* nodes;
+    int node_count;
+    int depth;                    // Interior nodes on the longest path down
+    vector<Primitive> ordered_prims;
+
+    // Leaf triangles packed for the SIMD intersection kernel
+    TriangleBlocks* blocks;
+
+    // Meshes' trees flatten() put in place of their leaves, and the first of
+    // ordered_prims that each one's faces take up
+    vector<BoundingTree*> subtrees;
+    vector<int> subtree_offsets;
+
+    // Optional 4 or 8 wide copy of the tree, used for traversal instead
+    WideTree* wide;
+
+    // Cache file the nodes are mapped from, if they were loaded from disk
+    void* mapping;
+    size_t mapping_size;
+
+    // Build nodes are handed out from one allocation during construction
+    BuildNode* pool;
+    int pool_used;
 
     // Methods
-    void create_bounding_box(vector<Shape*> shapes, 
-        BoundingBox *last_bbox, int axis, bool left);
+    Shape* intersect_object(Ray ray, Primitive skip);
+    bool intersect_closest(Ray ray, Primitive skip, HitRecord* hit);
+    bool occluded(Ray ray, Primitive skip);
+
+    float sah_cost();
+
+    void flatten(BuildNode* root, vector<PrimitiveInfo>& prims);
+    int flatten_node(BuildNode* node, vector<PrimitiveInfo>& prims,
+        vector<int>& first_prims, int* offset, int level);
+
+    // Builders
+    static BoundingTree* build(vector<Shape*> shapes,
+        vector<TriangleMesh*>& meshes);
+    static BoundingTree* build_mesh(TriangleMesh* mesh);
+    static vector<PrimitiveInfo> gather_primitives(vector<Shape*>& shapes);
+    static int block_width();
 
-    void init_root_bbox(vector<Shape*> shapes);
-    void init_child_bbox(BoundingBox* last_bbox);
-    void split_left_bbox(BoundingBox* last_bbox, vector<Shape*> shapes, int axis);
-    void split_right_bbox(BoundingBox* last_bbox, vector<Shape*> shapes, int axis);
+    void build_nodes(vector<PrimitiveInfo>& prims);
 
-    vector<Shape*> sort_shapes(vector<Shape*> shapes, int axis, 
-        bool check_max);
+    BuildNode* new_node();
+    BuildNode* build_sah(vector<PrimitiveInfo>& prims, int start, 
+        int end, int level);
+    BuildNode* build_median(vector<PrimitiveInfo>& prims, int start, 
+        int end, int axis);
 
-    Shape* intersect_object(Ray ray, Shape* shadow_shape);
+    static void compute_bounds(vector<PrimitiveInfo>& prims, int start, 
+        int end, BoundingBox* bbox, BoundingBox* centroid_bbox);
+    static void bin_shapes(vector<PrimitiveInfo>& prims, int start, 
+        int end, BoundingBox* centroid_bbox, int* counts, BoundingBox* bboxes);
+    static float find_sah_split(vector<PrimitiveInfo>& prims, int start, 
+        int end, BoundingBox* bbox, BoundingBox* centroid_bbox, int* best_axis, 
+        int* best_bin);
+    static bool holds_subtree(vector<PrimitiveInfo>& prims, int start,
+        int end);
 
     // Constructor
     BoundingTree();
-    BoundingTree(vector<Shape*> shapes, BoundingBox* last_bbox, int axis, 
-        bool left);
 
     // Destructor
     void dispose();
@@ -0,0 +1,78 @@
+#ifndef BVHCACHE_H
+#define BVHCACHE_H
+#endif
+
+#include <string>
+#include <vector>
+
+#ifndef BOUNDTREE_H
+#include "boundtree.h"
+#endif
+
+#ifndef TRIANGLEMESH_H
+#include "trianglemesh.h"
+#endif
+
+#ifndef MATRIX_H
+#include "matrix.h"
+#endif
+
+// "RBVH", and the layout version of the file. Bump the version whenever
+// LinearNode, the triangle blocks, the mesh or the header change.
+#define BVH_CACHE_MAGIC 0x48564252
+#define BVH_CACHE_VERSION 3
+
+using namespace std;
+
+//*****************************************************************************
+// CacheHeader
+//*****************************************************************************
+
+// First 64 bytes of a mesh's cache file. After it come the mesh's flattened
+// tree, the face at each place its leaves refer to, the packed triangle
+// blocks with their lanes and the first block of each leaf, and then the
+// mesh itself: vertices, normals, texture coordinates and the three index
+// buffers, so a mesh loaded from it is never parsed.
+
+class CacheHeader {
+
+  public:
+
+    // Declarations
+    unsigned int magic;
+    unsigned int version;
+    unsigned long long key;
+    int node_count;
+    int face_count;
+    int vertex_count;
+    int normal_count;
+    int tcoord_count;
+    int block_count;
+    int block_width;
+    int depth;
+    int flat_faces;           // Faces wound towards view_origin
+    float view_origin[3];
+
+};
+
+//*****************************************************************************
+// BVHCache
+//*****************************************************************************
+
+// Each .obj file's mesh and tree, cached next to it in <file>.obj.bvh
+
+class BVHCache {
+
+  public:
+
+    // Settings
+    static bool enabled;
+
+    // Methods
+    static unsigned long long key(unsigned long long contents, 
+        const Matrix& transform);
+
+    static bool load(TriangleMesh* mesh, string path, unsigned long long key);
+    static bool save(TriangleMesh* mesh, string path, unsigned long long key);
+
+};
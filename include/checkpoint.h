@@ -0,0 +1,80 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+#endif
+
+#include <string>
+#include <vector>
+
+#ifndef FILM_H
+#include "film.h"
+#endif
+
+// "RCKP", and the layout version of the file. Bump the version whenever the
+// header or the film's buffers change.
+#define CHECKPOINT_MAGIC 0x504b4352
+#define CHECKPOINT_VERSION 4
+
+using namespace std;
+
+//*****************************************************************************
+// CheckpointHeader
+//*****************************************************************************
+
+// First 64 bytes of a checkpoint file. It records the scene and the
+// settings the samples were taken with, since resuming under different ones
+// would mix sample sequences. After it come one byte per tile, set for the
+// tiles the current pass has finished, and then the film's sums, counts,
+// unclamped sums when writing HDR output, and squares when sampling is
+// adaptive.
+
+class CheckpointHeader {
+
+  public:
+
+    // Declarations
+    unsigned int magic;
+    unsigned int version;
+    unsigned long long identity;  // Hash of the scene's input files
+    int width;
+    int height;
+    int samples;
+    int strategy;
+    int max_samples;
+    float max_error;
+    int tile_size;
+    int tile_count;
+    int pass;
+    int passes;
+    char pad[8];
+
+};
+
+//*****************************************************************************
+// Checkpoint
+//*****************************************************************************
+
+// A copy of the film and of which tiles are done, taken between two tiles.
+// Taking it is quick, so the render only has to stop for that, and the slow
+// write to disk can happen while the other threads carry on.
+
+class Checkpoint {
+
+  public:
+
+    // Declarations
+    CheckpointHeader header;
+    vector<char> done;
+    vector<float> accumulation;
+    vector<int> sample_counts;
+    vector<float> radiance;
+    vector<double> luminance_squares;
+
+    // Methods
+    void capture(Film* film, unsigned long long identity, int pass,
+        vector<char>& tiles_done);
+    bool save(string path);
+
+    static bool load(Film* film, unsigned long long identity, string path,
+        int* pass, vector<char>& done);
+
+};
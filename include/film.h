@@ -4,6 +4,10 @@
 
 #include <stdlib.h>
 #include <math.h>
+#include <omp.h>
+
+#include <string>
+#include <vector>
 
 #include "lodepng.h"
 
@@ -11,23 +15,106 @@
 #include "vector.h"
 #endif
 
+#ifndef PNGWRITER_H
+#include "pngwriter.h"
+#endif
+
+#ifndef HDRWRITER_H
+#include "hdrwriter.h"
+#endif
+
+using namespace std;
+
+//*****************************************************************************
+// PixelSamples
+//*****************************************************************************
+
+// Running sums over some of a pixel's samples
+
+class PixelSamples {
+
+  public:
+
+    // Declarations
+    Vector color_sum;
+    Vector radiance_sum;        // Unclamped, only kept for HDR output
+    double luminance_squares;   // Sum of each sample's squared luminance
+    int count;
+
+    // Methods
+    void add(const PixelSamples& samples);
+    double error();
+
+    // Constructor
+    PixelSamples();
+
+};
+
 //*****************************************************************************
 // Film
 //*****************************************************************************
 
+// Accumulates the samples of every pixel in floating point, so a pixel can
+// be refined by later passes. The 8 bit image is only made from the sums
+// when it is written.
+//
+// When streaming, none of that is kept. Each pixel is rendered once, and
+// goes straight into the 8 bit rows of its band, which is written to the PNG
+// and freed as soon as it and every band above it are finished. Bands are
+// compressed and written outside the lock tiles are added under, by one
+// thread at a time.
+
 class Film {
   
   public:
       
+    // Settings
+    static int png_mode;          // A PNGWriter mode
+    static int hdr_format;        // An HDRWriter format, or NONE
+    static bool streaming;
+
     // Declarations
     int width;
     int height;
     char* output;
+
+    float* accumulation;          // RGB sum of each pixel's samples
+    float* radiance;              // The same unclamped, NULL unless writing
+                                  // HDR output
+    int* sample_counts;           // Primary rays each pixel took
+    double* luminance_squares;    // Sum of each sample's squared luminance,
+                                  // NULL unless sampling is adaptive
+
+    // Streaming
+    PNGStream stream;
+    int band_rows;
+    int next_band;                // First band not yet written
+    int ready_bands;              // Bands before this one are finished
+    omp_lock_t stream_lock;       // Held by the thread writing bands
+    vector<unsigned char*> bands; // 8 bit rows of each band, NULL if none
+    vector<int> tiles_left;       // Tiles each band is still waiting for
+    int resident_bands;
+    int max_resident_bands;
+    long long streamed_samples;
+    double encode_time;
     
     // Methods
+    void add_samples(int x, int y, const PixelSamples& samples);
+    PixelSamples get_samples(int x, int y);
+    Vector get_color(int x, int y);
+    double average_samples();
+
     void set_pixel(int x, int y, Vector color);
     void write_to_image();
+    void write_hdr();
     void dispose();
+
+    void begin_stream(int rows_per_band, int tiles_per_band);
+    void finish_tile(int band);
+    void write_bands();
+    void end_stream();
+
+    static double luminance(const Vector& color);
     
     // Constructor
     Film();
@@ -37,4 +124,4 @@ class Film {
     
     unsigned char* image;
   
-};
\ No newline at end of file
+};
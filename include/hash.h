@@ -0,0 +1,27 @@
+#ifndef HASH_H
+#define HASH_H
+#endif
+
+#include <stddef.h>
+#include <stdio.h>
+
+// Where every FNV-1a hash starts
+#define HASH_SEED 14695981039346656037ULL
+
+//*****************************************************************************
+// Hash
+//*****************************************************************************
+
+// 64 bit FNV-1a, for telling whether files written by an earlier run were
+// made from the same inputs. Not meant to resist deliberate collisions.
+
+class Hash {
+
+  public:
+
+    // Methods
+    static unsigned long long bytes(unsigned long long hash, const void* data,
+        size_t size);
+    static unsigned long long file(unsigned long long hash, FILE* file);
+
+};
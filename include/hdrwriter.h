@@ -0,0 +1,37 @@
+#ifndef HDRWRITER_H
+#define HDRWRITER_H
+#endif
+
+//*****************************************************************************
+// HDRWriter
+//*****************************************************************************
+
+// Writes the film's unclamped radiance, so exposure and tone mapping can be
+// changed afterwards without tracing the scene again. PFM is 32 bit float
+// RGB. EXR is a single part scanline OpenEXR file with uncompressed half
+// float R, G and B channels, the simplest form every EXR reader accepts.
+
+class HDRWriter {
+
+  public:
+
+    // Formats
+    static const int NONE = 0;
+    static const int PFM = 1;
+    static const int EXR = 2;
+
+    static const char* format_names[3];
+
+    // Methods
+    static int parse_format(const char* name);
+
+    static bool write(const char* path, const float* rgb, int width,
+        int height, int format);
+    static bool write_pfm(const char* path, const float* rgb, int width,
+        int height);
+    static bool write_exr(const char* path, const float* rgb, int width,
+        int height);
+
+    static unsigned short float_to_half(float value);
+
+};
@@ -0,0 +1,39 @@
+#ifndef HITRECORD_H
+#define HITRECORD_H
+#endif
+
+#include <stdlib.h>
+
+#ifndef VECTOR_H
+#include "vector.h"
+#endif
+
+using namespace std;
+
+class Shape;
+
+//*****************************************************************************
+// HitRecord
+//*****************************************************************************
+
+class HitRecord {
+
+  public:
+
+    // Declarations
+    Shape* shape;
+    int index;                // Which of the shape's primitives was hit
+    float t;
+    float beta;               // Barycentric coordinates on triangles
+    float gamma;
+
+    Vector point;
+    Vector normal;            // Geometric normal
+    Vector shading_normal;    // Interpolated normal, used for lighting
+    float u;
+    float v;
+
+    // Constructor
+    HitRecord();
+
+};
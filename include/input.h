@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <omp.h>
 
 // Self-defined
 
@@ -50,6 +51,22 @@
 #include "vector.h"
 #endif
 
+#ifndef BOUNDTREE_H
+#include "boundtree.h"
+#endif
+
+#ifndef TRIANGLEMESH_H
+#include "trianglemesh.h"
+#endif
+
+#ifndef HASH_H
+#include "hash.h"
+#endif
+
+#ifndef BVHCACHE_H
+#include "bvhcache.h"
+#endif
+
 //****************************************************
 // InputUtils
 //****************************************************
@@ -68,13 +85,15 @@ class InputUtils {
     
     // Objects
     static void parse_sphere_input(Scene* scene, char* input, 
-	Matrix transform_matrix, Material material, int linecount);
+	Matrix transform_matrix, const Material& material, int linecount);
     static void parse_triangle_input(Scene* scene, char* input, 
-	Matrix transform_matrix, Material material, int linecount);
+	Matrix transform_matrix, const Material& material, int linecount);
     static void parse_obj_input(Scene* scene, char* input,
-    Matrix transform_matrix, Material material, int linecount);
+    Matrix transform_matrix, const Material& material, int linecount);
     static int parse_face_input(char* input, int* vertnum,
     int* vnormnum, int* tcoordnum, int size, int linecount);
+    static void load_meshes(Scene* scene);
+    static void load_mesh(Scene* scene, TriangleMesh* mesh);
     
     // Lights
     static void parse_ptlight_input(Scene* scene, char* input, 
@@ -100,7 +119,13 @@ class InputUtils {
 
     // Distributed Ray Tracing
     static void parse_antialias_input(char* input, int linecount);
+    static int parse_sampler_strategy(char* name);
     static void parse_refract_input(Material* material, char* input,
     int linecount);
+
+    // Acceleration structure
+    static void parse_bvh_input(char* input, int linecount);
+    static int parse_bvh_method(char* name);
+    static bool valid_bvh_width(int width);
   
 };
\ No newline at end of file
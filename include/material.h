@@ -23,17 +23,21 @@ class Material {
     bool refract;
     static const bool alwaysRf = true;
     float phong_e;
-    static const float glassIndex = 1.52;
-    static const float airIndex = 1.0;
+    static const float glassIndex;
+    static const float airIndex;
     
     // Constructors
     
     Material();
     Material(Vector ka, Vector kd, Vector ks, Vector kr, float phong_e, bool refract);
 
-    Vector diffuse_c(Vector, Vector, Vector);
-    Vector ambient_c(Vector);
-    Vector specular_c(Vector, Vector, Vector, Vector);
+    bool equals(const Material& other) const;
+
+    Vector diffuse_c(const Vector& color, const Vector& light, 
+        const Vector& normal) const;
+    Vector ambient_c(const Vector& color) const;
+    Vector specular_c(const Vector& color, const Vector& light, 
+        const Vector& viewer, const Vector& normal) const;
     
 };
 
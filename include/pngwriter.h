@@ -0,0 +1,77 @@
+#ifndef PNGWRITER_H
+#define PNGWRITER_H
+#endif
+
+#include <stdio.h>
+#include <vector>
+
+// Image rows per independently compressed band
+#define PNG_BAND_ROWS 64
+
+using namespace std;
+
+//*****************************************************************************
+// PNGWriter
+//*****************************************************************************
+
+// Writes the film's PNGs. BEST hands the image to lodepng as it always has,
+// and the other modes are a quick encoder for previews, writing 24 bit RGB.
+// The image is cut
+// into bands of rows, and each band is deflated on its own thread with no
+// references into the bands before it, ending on a byte boundary with an
+// empty stored block. The bands then go into the file one IDAT chunk each,
+// so together they form a single zlib stream. Band boundaries depend only
+// on the image height, so the file is the same whatever the thread count.
+
+class PNGWriter {
+
+  public:
+
+    // Compression modes
+    static const int STORED = 0;    // No compression at all
+    static const int FAST = 1;      // Greedy LZ77 with fixed Huffman codes
+    static const int BEST = 2;      // lodepng's defaults, RGBA
+
+    static const char* mode_names[3];
+
+    // Methods
+    static int parse_mode(const char* name);
+
+    static unsigned write(const char* path, const unsigned char* rgba,
+        int width, int height, int mode);
+
+    static void compress_band(const unsigned char* rgba, int width,
+        int first_row, int end_row, int mode, vector<unsigned char>& chunk,
+        unsigned int* adler);
+
+};
+
+//*****************************************************************************
+// PNGStream
+//*****************************************************************************
+
+// A PNG written a band of rows at a time, in PNGWriter's format, so the
+// whole image never has to be in memory. The file is flushed after every
+// band, and is a complete image once closed.
+
+class PNGStream {
+
+  public:
+
+    // Declarations
+    FILE* file;
+    int width;
+    int height;
+    int mode;                 // STORED or FAST
+    unsigned int adler;       // Checksum of the rows so far
+    int rows_written;
+    bool failed;
+
+    // Methods
+    bool open(const char* path, int width, int height, int mode);
+    void add_band(const vector<unsigned char>& chunk, unsigned int band_adler,
+        int rows);
+    void write_rows(const unsigned char* rgba, int rows);
+    bool close();
+
+};
@@ -0,0 +1,34 @@
+#ifndef PRIMITIVE_H
+#define PRIMITIVE_H
+#endif
+
+#include <stdlib.h>
+
+using namespace std;
+
+class Shape;
+
+//*****************************************************************************
+// Primitive
+//*****************************************************************************
+
+// One intersectable piece of a shape: the shape itself for spheres and single
+// triangles, or one face of a mesh. The tree's leaves point at these, and
+// rays use them to skip the surface they start on.
+
+class Primitive {
+
+  public:
+
+    // Declarations
+    Shape* shape;
+    int index;
+
+    // Methods
+    bool is(Shape* other_shape, int other_index);
+
+    // Constructors
+    Primitive();
+    Primitive(Shape* primitive_shape, int primitive_index);
+
+};
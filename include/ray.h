@@ -19,9 +19,15 @@ class Ray {
     bool into;
     float t_min;
     float t_max;
+
+    // Cached for box tests: 1 / direction, and 1 where a component is negative
+    Vector inv_direction;
+    int sign[3];
     
     Ray();
     Ray(Vector pos, Vector dir, float min, float max);
+
+    void set_direction(Vector dir);
     
     static void print(Ray input);
   
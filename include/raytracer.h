@@ -48,18 +48,20 @@ class Raytracer {
 
     // Methods
     static Vector reflection_v(Vector direction, Vector normal);
-    static bool shadow_ray(Scene* scene, Ray ray, Shape* shape);
-    static void shine_dir_lights(Shape* shape, Vector *color, Scene *scene, 
-        Material material, Vector surface, Vector viewer, Vector normal);
-    static void shine_point_lights(Shape* shape, Vector *color, Scene* scene, 
-        Material material, Vector surface, Vector viewer, Vector normal);
+    static bool shadow_ray(Scene* scene, Ray ray, Primitive surface);
+    static void shine_dir_lights(Primitive prim, Vector *color, Scene *scene, 
+        const Material& material, const Vector& surface, 
+        const Vector& viewer, const Vector& normal);
+    static void shine_point_lights(Primitive prim, Vector *color, 
+        Scene* scene, const Material& material, const Vector& surface, 
+        const Vector& viewer, const Vector& normal);
     static void shine_ambient_lights(Vector *color, Scene* scene, 
-      Material material);
+      const Material& material);
 
     static void trace(Scene* scene, Ray ray, int depth, Vector* color,
-        Shape* last_shape);
+        Vector* radiance, Primitive last_prim);
 
-    static bool canRefract(Vector direction, Vector normal, float index, Material material);
-    static Ray refract(Vector direction, Vector normal, float index, Material material, Vector intersect);
+    static bool canRefract(Vector direction, Vector normal, float index, const Material& material);
+    static Ray refract(Vector direction, Vector normal, float index, const Material& material, Vector intersect);
 
 };
\ No newline at end of file
@@ -0,0 +1,29 @@
+#ifndef RNG_H
+#define RNG_H
+#endif
+
+//*****************************************************************************
+// RNG
+//*****************************************************************************
+
+// PCG32 (O'Neill, pcg-random.org): 64 bits of state, 32 bit outputs. Every
+// pixel sample gets its own generator, seeded from the pixel and the sample
+// index, so draws do not depend on which thread renders what or in which
+// order, and no state is shared between threads.
+
+class RNG {
+
+  public:
+
+    // Declarations
+    unsigned long long state;
+    unsigned long long increment;
+
+    // Methods
+    unsigned int next_uint();
+    float next_float();
+
+    // Constructor
+    RNG(unsigned long long seed, unsigned long long stream);
+
+};
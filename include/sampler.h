@@ -17,12 +17,66 @@
 // Classes and Methods
 //****************************************************
 
+// Adaptive sampling never judges a pixel on fewer samples than this
+#define MIN_ADAPTIVE_SAMPLES 4
+
+// Generates the points on the view plane that a pixel's primary rays go
+// through. Each render thread keeps its own Sampler, and the points are
+// written into a buffer the caller owns, so nothing is allocated per pixel.
+// Every strategy can be extended past samples points, which adaptive
+// sampling uses to add points to pixels that have not converged.
+
 class Sampler {
 
 public:
 
-    static int samples;
+    // Strategies for placing a pixel's samples
+    static const int JITTER = 0;      // One random point per cell of a grid
+    static const int SOBOL = 1;       // Owen-scrambled Sobol points
+    static const int HALTON = 2;      // Halton points, rotated per pixel
+    static const int BLUE_NOISE = 3;  // A rank-1 lattice offset by a blue-noise mask
+
+    static int samples;               // Per pixel
+    static int strategy;
+
+    // Adaptive sampling
+    static int max_samples;           // Per pixel cap, 0 when off
+    static float max_error;           // Standard error a pixel settles for
+
+    // Declarations
+    Camera* camera;
+    int width;
+    int height;
+
+    Vector left_edge;     // Upper left to lower left corner
+    Vector right_edge;    // Upper right to lower right corner
+
+    // Moving one pixel row down, the left end of a row moves by left_step,
+    // and its span from left to right end changes by span_step
+    Vector left_step;
+    Vector span_step;
+
+    // Left and right ends of the row through the centre of pixel row
+    // current_row, which is all a single sample per pixel needs, and the
+    // left end and span of the row along its top for the other samples
+    int current_row;
+    Vector row_left;
+    Vector row_right;
+    Vector row_top_left;
+    Vector row_top_span;
+
+    // Methods
+    static void prepare();
+    static bool adaptive();
+    static int base_samples();
+    static int buffer_size();
+
+    void set_row(int j);
+    int get_points(Vector* points, int i, int j, int first, int count);
+
+    Vector point(int i, float off_x, float off_y);
 
-    static void get_points(vector<Vector>* points, Camera* camera, int i, int j, int width, int height);
+    // Constructor
+    Sampler(Camera* camera, int width, int height);
 
-};
\ No newline at end of file
+};
@@ -45,10 +45,25 @@
 #include "triangle.h"
 #endif
 
+#ifndef TRIANGLEMESH_H
+#include "trianglemesh.h"
+#endif
+
 #ifndef BOUNDTREE_H
 #include "boundtree.h"
 #endif
 
+#ifndef TILESCHEDULER_H
+#include "tilescheduler.h"
+#endif
+
+#ifndef CHECKPOINT_H
+#include "checkpoint.h"
+#endif
+
+// Shapes refer to their material by a 16 bit index
+#define MAX_MATERIALS 65536
+
 using namespace std;
 
 //*****************************************************************************
@@ -58,27 +73,46 @@ using namespace std;
 class Scene {
 
   public:
-    
+
+    // Settings
+    static int passes;                // Progressive passes over the film
+    static int checkpoint_interval;   // Seconds, 0 for no checkpoints
+    static bool resume;
+
     // Declarations
 
     Camera camera;
     Film film;
 
     BoundingTree* bbox_tree;
+    string checkpoint;        // Where render progress is saved
+    unsigned long long identity;  // Hash of the input file and its meshes
 
     vector<DirLight> dir_lights;
     vector<PointLight> point_lights;
     vector<Light> ambient_lights;
-    vector<Shape*> surfaces;
+    vector<Shape*> surfaces;        // Everything but the meshes
+    vector<TriangleMesh*> meshes;
+    vector<Material> materials;
     
     // Methods
 
     void add_surface(Shape* surface);
+    void add_mesh(TriangleMesh* mesh);
+    unsigned short add_material(const Material& material);
     void add_dir_light(DirLight dir_light);
     void add_point_light(PointLight point_light);
     void add_ambient_light(Light ambient_light);
    
     void render();
+    int render_tile(const Tile& tile, Sampler* sampler, Vector* points,
+        PixelSamples* updates);
+    Vector trace_points(Vector* points, int count, double* luminance_squares,
+        Vector* radiance_sum);
+    bool needs_samples(PixelSamples samples, const PixelSamples& added);
+
+    void add_tile(const Tile& tile, PixelSamples* updates);
+    void save_checkpoint(Checkpoint* snapshot);
     
     // Destructor
     
@@ -18,6 +18,10 @@
 #include "bounding.h"
 #endif
 
+#ifndef HITRECORD_H
+#include "hitrecord.h"
+#endif
+
 using namespace std;
 
 //*****************************************************************************
@@ -29,14 +33,31 @@ class Shape {
   public:
 
     Matrix transform;
-    Material material;
+    unsigned short material;    // Index into the scene's material table
 
     BoundingBox bbox;
 
-    virtual bool intersect(Ray) =0;
-    virtual Vector intersectP(Ray) =0;
-    virtual float intersectT(Ray ray) =0;
-    virtual Vector get_normal(Vector intersection) =0;
     virtual void compute_bounding_box() =0;
 
+    // Shapes are made of primitive_count() pieces, which the tree bounds and
+    // intersects one at a time
+    virtual int primitive_count() =0;
+    virtual BoundingBox primitive_bbox(int index) =0;
+
+    // Nearest hit on one primitive within [ray.t_min, ray.t_max]. On a hit,
+    // fills in everything shading needs in the same evaluation.
+    virtual bool intersect(const Ray& ray, int index, HitRecord& hit) =0;
+
+    // Whether the primitive is hit at all, for shadow rays
+    virtual bool occludes(const Ray& ray, int index) =0;
+
+    // Fills in the rest of a hit whose t, and barycentric coordinates for
+    // triangles, are already known
+    virtual void fill_hit(const Ray& ray, int index, HitRecord& hit) =0;
+
+    // Corners of a triangle primitive, so the tree can pack them for its SIMD
+    // kernel. Returns false for anything that is not a triangle.
+    virtual bool get_triangle(int index, Vector* v1, Vector* v2, 
+        Vector* v3) =0;
+
 };
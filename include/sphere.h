@@ -23,17 +23,31 @@ class Sphere : public Shape {
 		Vector center;
 		float radius;
 
+		// World to sphere space as the rows of a 3x4 affine matrix, and the
+		// transpose of its linear part for normals. Neither is used when the
+		// transform is the identity.
+		float affine[12];
+		float normal_matrix[9];
+		bool identity;
+
 		// Method overloads
-		bool intersect(Ray);
-    Vector intersectP(Ray);
-    float intersectT(Ray ray);
-    Vector get_normal(Vector intersection);
-    void compute_bounding_box();
+		void compute_bounding_box();
+
+		int primitive_count();
+		BoundingBox primitive_bbox(int index);
+		bool intersect(const Ray& ray, int index, HitRecord& hit);
+		bool occludes(const Ray& ray, int index);
+		void fill_hit(const Ray& ray, int index, HitRecord& hit);
+		bool get_triangle(int index, Vector* v1, Vector* v2, Vector* v3);
     
-    Ray transform_ray(Ray ray);
+		float solve(const Ray& ray);
+
+		void set_transform(Matrix world_to_local);
+		Vector local_point(const Vector& point);
+		Vector local_direction(const Vector& direction);
 
 		//constructors
 		Sphere();
-		Sphere(Matrix, Vector, float, Material material);
+		Sphere(Matrix, Vector, float, unsigned short material);
 
 };
@@ -0,0 +1,97 @@
+#ifndef TILESCHEDULER_H
+#define TILESCHEDULER_H
+#endif
+
+#include <vector>
+#include <omp.h>
+
+using namespace std;
+
+//*****************************************************************************
+// Tile
+//*****************************************************************************
+
+// Pixels [x_min, x_max) x [y_min, y_max) of the film
+
+class Tile {
+
+  public:
+
+    // Declarations
+    int x_min;
+    int y_min;
+    int x_max;
+    int y_max;
+    int index;          // Position in the scheduler's Morton order
+
+};
+
+//*****************************************************************************
+// TileQueue
+//*****************************************************************************
+
+// One thread's deque: the tiles [front, back) of the scheduler's tile list.
+// The owner takes tiles from the front, and thieves take from the back.
+// Padded to a cache line so threads never share one.
+
+class TileQueue {
+
+  public:
+
+    // Load balance statistics
+    double busy_time;
+    int tiles_rendered;
+    int tiles_stolen;
+
+    // Declarations
+    omp_lock_t lock;
+    int front;
+    int back;
+
+    char pad[64 - sizeof(double) - 4 * sizeof(int) - sizeof(omp_lock_t)];
+
+};
+
+//*****************************************************************************
+// TileScheduler
+//*****************************************************************************
+
+// Splits the film into square tiles in Morton order, so neighbouring tiles
+// (and the geometry they see) are rendered close together. Each thread
+// starts with a contiguous run of them, and a thread that runs out steals
+// the back half of the fullest remaining queue.
+//
+// In order, the tiles go row by row instead, and every thread takes the
+// next one from a single shared counter, so the rows of the film finish
+// roughly from top to bottom.
+
+class TileScheduler {
+
+  public:
+
+    // Settings
+    static int tile_size;
+    static int threads;       // 0 leaves the choice to OpenMP
+
+    // Declarations
+    int thread_count;
+    vector<Tile> tiles;
+    TileQueue* queues;
+
+    bool in_order;
+    int next_tile;            // Used in order
+
+    // Methods
+    bool next(int thread, Tile* tile);
+    bool steal(int thread);
+    void reset();
+
+    void report(double render_time);
+
+    // Constructor
+    TileScheduler(int width, int height, bool in_order);
+
+    // Destructor
+    void dispose();
+
+};
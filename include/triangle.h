@@ -27,18 +27,31 @@ class Triangle : public Shape {
     Vector tcoord3;
 
     // Method Overloads
-    bool intersect(Ray);
-    Vector intersectP(Ray);
-    float intersectT(Ray ray);
-    Vector get_normal(Vector intersection);
     void compute_bounding_box();
 
+    int primitive_count();
+    BoundingBox primitive_bbox(int index);
+    bool intersect(const Ray& ray, int index, HitRecord& hit);
+    bool occludes(const Ray& ray, int index);
+    void fill_hit(const Ray& ray, int index, HitRecord& hit);
+    bool get_triangle(int index, Vector* v1, Vector* v2, Vector* v3);
+
     void do_transform(Matrix matrix);
 
+    // Shared with TriangleMesh, which keeps its corners in arrays
+    static bool intersect_face(const Ray& ray, const Vector& v1, 
+        const Vector& v2, const Vector& v3, HitRecord& hit);
+    static void fill_face(const Ray& ray, const Vector& v1, const Vector& v2,
+        const Vector& v3, const Vector& vnorm1, const Vector& vnorm2, 
+        const Vector& vnorm3, const Vector& tcoord1, const Vector& tcoord2, 
+        const Vector& tcoord3, HitRecord& hit);
+    static Vector interpolate_normal(float beta, float gamma, 
+        const Vector& vnorm1, const Vector& vnorm2, const Vector& vnorm3);
+
     //constructors
     Triangle();
-    Triangle(Matrix, Vector, Vector, Vector, Vector, Material);
+    Triangle(Matrix, Vector, Vector, Vector, Vector, unsigned short);
     Triangle(Matrix, Vector, Vector, Vector, Vector, Vector, Vector,
-        Vector, Vector, Vector, Material);
+        Vector, Vector, Vector, unsigned short);
 
 };
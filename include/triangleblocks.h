@@ -0,0 +1,72 @@
+#ifndef TRIANGLEBLOCKS_H
+#define TRIANGLEBLOCKS_H
+#endif
+
+#include <vector>
+
+#ifndef BOUNDTREE_H
+#include "boundtree.h"
+#endif
+
+#ifndef RAY_H
+#include "ray.h"
+#endif
+
+#ifndef HITRECORD_H
+#include "hitrecord.h"
+#endif
+
+#ifndef PRIMITIVE_H
+#include "primitive.h"
+#endif
+
+// Rows of one block: first corner, then both edges, x y z each. Blocks are
+// 4 or 8 triangles wide.
+#define TRIANGLE_BLOCK_ROWS 9
+#define TRIANGLE_MAX_WIDTH 8
+
+using namespace std;
+
+//*****************************************************************************
+// TriangleBlocks
+//*****************************************************************************
+
+// The triangles of every leaf packed for the SIMD intersection kernel. A leaf
+// whose primitives are all triangles owns ceil(count / width) consecutive
+// blocks, and block b stores its first corner and two edges in structure-of-
+// arrays form at data[b * 9 * width], one row of width floats per component.
+// Leaves holding anything else keep using the shapes' own tests. The leaves
+// of a mesh's tree spliced into a bigger one keep the blocks the mesh's tree
+// packed them into.
+
+class TriangleBlocks {
+
+  public:
+
+    // Declarations
+    int width;
+    int block_count;
+    float* data;
+    int* lanes;         // Leaf-ordered primitive in each lane, -1 if empty
+    int* leaf_blocks;   // First block of the leaf starting at a primitive
+    vector<Primitive>* prims;
+
+    // Methods
+    void allocate_blocks();
+
+    int intersect_block(int block, const Ray& ray, float* t, float* beta,
+        float* gamma);
+
+    bool intersect_leaf(int first, int count, Ray& ray, Primitive skip,
+        HitRecord* hit);
+    bool occluded_leaf(int first, int count, const Ray& ray, Primitive skip);
+
+    // Constructors
+    TriangleBlocks(BoundingTree* tree, int block_width);
+    TriangleBlocks(vector<Primitive>* primitives, int block_width, 
+        int blocks);
+
+    // Destructor
+    void dispose();
+
+};
@@ -0,0 +1,75 @@
+#ifndef TRIANGLEMESH_H
+#define TRIANGLEMESH_H
+#endif
+
+#include <string>
+#include <vector>
+
+#ifndef SHAPE_H
+#include "shape.h"
+#endif
+
+#ifndef VECTOR_H
+#include "vector.h"
+#endif
+
+#ifndef TRIANGLE_H
+#include "triangle.h"
+#endif
+
+using namespace std;
+
+class BoundingTree;
+
+//*****************************************************************************
+// TriangleMesh
+//*****************************************************************************
+
+// All faces of one .obj file. Corners are shared between faces through index
+// buffers, with three entries per face in each buffer, so a face costs 36
+// bytes instead of a whole Triangle. Each face is one primitive of the shape.
+// The faces are read once the tree settings are known, since the mesh's tree
+// is cached along with them.
+
+class TriangleMesh : public Shape {
+
+  public:
+
+    // Declarations
+    string source;                  // .obj file the faces are read from
+    Vector view_origin;             // Camera position flat faces wind towards
+    BoundingTree* tree;             // Over the faces, until the scene's takes it
+
+    vector<Vector> vertices;        // Already transformed
+    vector<Vector> normals;         // Normalised, as given by the file
+    vector<Vector> tcoords;
+
+    vector<int> vertex_indices;
+    vector<int> normal_indices;     // All 0 for faces without normals
+    vector<int> tcoord_indices;
+
+    // Methods
+    void add_vertex(Vector vertex);
+    void add_normal(Vector normal);
+    void add_tcoord(Vector tcoord);
+    bool add_face(int* vertnum, int* vnormnum, int* tcoordnum, 
+        Vector camera_origin);
+
+    int face_count();
+    bool flat_face(int index);
+
+    // Method Overloads
+    void compute_bounding_box();
+
+    int primitive_count();
+    BoundingBox primitive_bbox(int index);
+    bool intersect(const Ray& ray, int index, HitRecord& hit);
+    bool occludes(const Ray& ray, int index);
+    void fill_hit(const Ray& ray, int index, HitRecord& hit);
+    bool get_triangle(int index, Vector* v1, Vector* v2, Vector* v3);
+
+    // Constructors
+    TriangleMesh();
+    TriangleMesh(Matrix trans, unsigned short mat);
+
+};
@@ -21,8 +21,8 @@ class Vector {                                        // note: vectors are simpl
   public:                                             // so things like points and colors use Vector
 
     float x, y, z;
-    float len();
-    Vector normalize();
+    float len() const;
+    Vector normalize() const;
     void clamp();
 
     Vector& operator+=(const Vector&);
@@ -43,5 +43,5 @@ class Vector {                                        // note: vectors are simpl
 Vector operator+(Vector, const Vector&);
 Vector operator-(Vector, const Vector&);
 Vector operator*(Vector, const float);
-Vector operator*(const float, Vector&);
+Vector operator*(const float, const Vector&);
 Vector operator/(Vector, const float);
\ No newline at end of file
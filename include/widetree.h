@@ -0,0 +1,91 @@
+#ifndef WIDETREE_H
+#define WIDETREE_H
+#endif
+
+#include <vector>
+
+#ifndef BOUNDTREE_H
+#include "boundtree.h"
+#endif
+
+#ifndef RAY_H
+#include "ray.h"
+#endif
+
+#ifndef SHAPE_H
+#include "shape.h"
+#endif
+
+#ifndef HITRECORD_H
+#include "hitrecord.h"
+#endif
+
+#ifndef TRIANGLEBLOCKS_H
+#include "triangleblocks.h"
+#endif
+
+// Widest node supported, and the deepest stack a wide traversal can need
+#define WIDE_MAX_WIDTH 8
+#define WIDE_STACK_SIZE 256
+
+using namespace std;
+
+//*****************************************************************************
+// WideRay
+//*****************************************************************************
+
+// Per-ray values shared by every box test of one traversal. The near and far
+// rows pick which plane of each slab the ray enters through.
+
+class WideRay {
+
+  public:
+
+    float origin[3];
+    float inv_direction[3];
+    int near_row[3];
+    int far_row[3];
+    float t_min;
+    float t_max;
+
+    WideRay(const Ray& ray);
+
+};
+
+//*****************************************************************************
+// WideTree
+//*****************************************************************************
+
+// 4 or 8 wide tree collapsed from a flattened BoundingTree. Node i stores its
+// children's boxes in structure-of-arrays form at bounds[i * 6 * width], one
+// row of width floats for each of x_min, x_max, y_min, y_max, z_min, z_max,
+// so a single SIMD kernel can slab-test all of them at once.
+
+class WideTree {
+
+  public:
+
+    // Declarations
+    int width;
+    int node_count;
+    float* bounds;
+    int* children;            // Child node, or first primitive for leaf lanes
+    unsigned short* counts;   // Primitive count for leaf lanes, 0 otherwise
+    TriangleBlocks* blocks;
+    int stack_depth;          // Most entries a traversal can stack
+
+    // Methods
+    int collapse(LinearNode* nodes, int index);
+    int stack_needed(int node);
+    int intersect_node(int node, WideRay* ray, float* t_near);
+
+    bool intersect_closest(Ray ray, Primitive skip, HitRecord* hit);
+    bool occluded(Ray ray, Primitive skip);
+
+    // Constructor
+    WideTree(BoundingTree* tree, int tree_width);
+
+    // Destructor
+    void dispose();
+
+};
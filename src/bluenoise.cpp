@@ -0,0 +1,187 @@
+#include <math.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "bluenoise.h"
+
+#ifndef RNG_H
+#include "rng.h"
+#endif
+
+using namespace std;
+
+//*****************************************************************************
+// BlueNoise
+//*****************************************************************************
+
+float* BlueNoise::mask = NULL;
+
+// Energy of a binary pattern: for every pixel, the sum of a toroidal Gaussian
+// over the set pixels. Kept up to date as pixels are set and cleared.
+class VoidAndCluster {
+
+  public:
+
+    int count;
+    vector<float> kernel;
+    vector<float> energy;
+    vector<bool> pattern;
+
+    VoidAndCluster() {
+
+      count = BLUE_NOISE_SIZE * BLUE_NOISE_SIZE;
+      kernel.resize(count);
+      energy.assign(count, 0);
+      pattern.assign(count, false);
+
+      for (int y = 0; y < BLUE_NOISE_SIZE; y++) {
+        for (int x = 0; x < BLUE_NOISE_SIZE; x++) {
+
+          // Distance the short way round the torus
+          int dx = min(x, BLUE_NOISE_SIZE - x);
+          int dy = min(y, BLUE_NOISE_SIZE - y);
+
+          kernel[y * BLUE_NOISE_SIZE + x] = exp(-(dx * dx + dy * dy) /
+              (2 * BLUE_NOISE_SIGMA * BLUE_NOISE_SIGMA));
+
+        }
+      }
+
+    }
+
+    void toggle(int p, bool value) {
+
+      int px = p % BLUE_NOISE_SIZE;
+      int py = p / BLUE_NOISE_SIZE;
+      float sign = value ? 1 : -1;
+
+      pattern[p] = value;
+
+      for (int y = 0; y < BLUE_NOISE_SIZE; y++) {
+
+        int ky = (y - py + BLUE_NOISE_SIZE) % BLUE_NOISE_SIZE;
+
+        for (int x = 0; x < BLUE_NOISE_SIZE; x++) {
+          int kx = (x - px + BLUE_NOISE_SIZE) % BLUE_NOISE_SIZE;
+          energy[y * BLUE_NOISE_SIZE + x] +=
+              sign * kernel[ky * BLUE_NOISE_SIZE + kx];
+        }
+
+      }
+
+    }
+
+    // The set pixel with the most set pixels around it
+    int tightest_cluster() {
+
+      int best = -1;
+
+      for (int p = 0; p < count; p++) {
+        if (pattern[p] && (best < 0 || energy[p] > energy[best])) {
+          best = p;
+        }
+      }
+
+      return best;
+
+    }
+
+    // The clear pixel furthest from any set pixel
+    int largest_void() {
+
+      int best = -1;
+
+      for (int p = 0; p < count; p++) {
+        if (!pattern[p] && (best < 0 || energy[p] < energy[best])) {
+          best = p;
+        }
+      }
+
+      return best;
+
+    }
+
+};
+
+// Builds the mask. Always seeded the same way, so renders are reproducible.
+void BlueNoise::generate() {
+
+  if (mask) {
+    return;
+  }
+
+  VoidAndCluster vc;
+  RNG rng(0, 0);
+
+  // Start from a random tenth of the pixels
+  int initial = vc.count / 10;
+
+  for (int ones = 0; ones < initial; ) {
+
+    int p = rng.next_uint() % vc.count;
+
+    if (!vc.pattern[p]) {
+      vc.toggle(p, true);
+      ones++;
+    }
+
+  }
+
+  // Move the tightest cluster into the largest void until that stops
+  // changing anything
+  while (true) {
+
+    int cluster = vc.tightest_cluster();
+    vc.toggle(cluster, false);
+
+    int hole = vc.largest_void();
+    vc.toggle(hole, true);
+
+    if (hole == cluster) {
+      break;
+    }
+
+  }
+
+  vector<int> rank(vc.count);
+  VoidAndCluster prototype = vc;
+
+  // Rank the initial pixels by removing the tightest cluster each time
+  for (int r = initial - 1; r >= 0; r--) {
+    int cluster = vc.tightest_cluster();
+    vc.toggle(cluster, false);
+    rank[cluster] = r;
+  }
+
+  // Then the rest, by filling the largest void each time. With a toroidal
+  // kernel that is also the tightest cluster of the clear pixels, so the
+  // same step covers both of the original method's later phases.
+  vc = prototype;
+
+  for (int r = initial; r < vc.count; r++) {
+    int hole = vc.largest_void();
+    vc.toggle(hole, true);
+    rank[hole] = r;
+  }
+
+  mask = (float*) malloc(vc.count * sizeof(float));
+
+  for (int p = 0; p < vc.count; p++) {
+    mask[p] = (rank[p] + 0.5f) / vc.count;
+  }
+
+}
+
+// Mask value for pixel (x, y), tiling the mask across the image
+float BlueNoise::value(int x, int y) {
+
+  return mask[(y % BLUE_NOISE_SIZE) * BLUE_NOISE_SIZE + x % BLUE_NOISE_SIZE];
+
+}
+
+void BlueNoise::dispose() {
+
+  free(mask);
+  mask = NULL;
+
+}
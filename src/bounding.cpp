@@ -1,3 +1,4 @@
+#include <limits>
 #include "bounding.h"
 
 using namespace std;
@@ -6,46 +7,98 @@ using namespace std;
 // BoundingBox
 //*****************************************************************************
 
-bool BoundingBox::intersect(Ray ray) {
+bool BoundingBox::intersect(const Ray& ray) {
 
-  // Return true if the ray is inside the bounding box
-  if (ray.position.x >= x_min && ray.position.x <= x_max &&
-      ray.position.y >= y_min && ray.position.y <= y_max &&
-      ray.position.z >= z_min && ray.position.z <= z_max) {
+  float t_entry;
 
-    return true;
+  return intersect(ray, &t_entry);
 
+}
+
+// Slab test limited to the ray's [t_min, t_max], which also reports the
+// distance at which the ray enters the box. The ray's direction signs pick
+// the near and far plane of each slab, so no min/max swaps are needed.
+bool BoundingBox::intersect(const Ray& ray, float* t_entry) {
+
+  float tx_near = ((ray.sign[0] ? x_max : x_min) - ray.position.x) * 
+      ray.inv_direction.x;
+  float tx_far = ((ray.sign[0] ? x_min : x_max) - ray.position.x) * 
+      ray.inv_direction.x;
+  float ty_near = ((ray.sign[1] ? y_max : y_min) - ray.position.y) * 
+      ray.inv_direction.y;
+  float ty_far = ((ray.sign[1] ? y_min : y_max) - ray.position.y) * 
+      ray.inv_direction.y;
+  float tz_near = ((ray.sign[2] ? z_max : z_min) - ray.position.z) * 
+      ray.inv_direction.z;
+  float tz_far = ((ray.sign[2] ? z_min : z_max) - ray.position.z) * 
+      ray.inv_direction.z;
+
+  float t_near = max(max(tx_near, ty_near), max(tz_near, ray.t_min));
+  float t_far = min(min(tx_far, ty_far), min(tz_far, ray.t_max));
+
+  if (t_near > t_far) {
+    return false;
   }
 
-  float t_min;
-  float t_max;
+  *t_entry = t_near;
 
-  float a = 1 / ray.direction.x;
-  float b = 1 / ray.direction.y;
-  float c = 1 / ray.direction.z;
+  return true;
 
-  float tx_min = (x_min - ray.position.x) * a;
-  float tx_max = (x_max - ray.position.x) * a;
-  float ty_min = (y_min - ray.position.y) * b;
-  float ty_max = (y_max - ray.position.y) * b;
-  float tz_min = (z_min - ray.position.z) * c;
-  float tz_max = (z_max - ray.position.z) * c;
+}
 
-  t_min = max(min(tx_min, tx_max), min(ty_min, ty_max));
-  t_min = max(t_min, min(tz_min, tz_max));
+// Empty box that any expand() will overwrite
+void BoundingBox::reset() {
 
-  t_max = min(max(tx_min, tx_max), max(ty_min, ty_max));
-  t_max = min(t_max, max(tz_min, tz_max));
+  x_min = numeric_limits<float>::infinity();
+  x_max = -1 * numeric_limits<float>::infinity();
+  y_min = numeric_limits<float>::infinity();
+  y_max = -1 * numeric_limits<float>::infinity();
+  z_min = numeric_limits<float>::infinity();
+  z_max = -1 * numeric_limits<float>::infinity();
 
-  if (t_min < 0) {
-    return false;
-  }
+}
 
-  if (t_min > t_max) {
-    return false;
+void BoundingBox::expand(BoundingBox* other) {
+
+  x_min = min(x_min, other->x_min);
+  x_max = max(x_max, other->x_max);
+  y_min = min(y_min, other->y_min);
+  y_max = max(y_max, other->y_max);
+  z_min = min(z_min, other->z_min);
+  z_max = max(z_max, other->z_max);
+
+}
+
+void BoundingBox::expand(Vector point) {
+
+  x_min = min(x_min, point.x);
+  x_max = max(x_max, point.x);
+  y_min = min(y_min, point.y);
+  y_max = max(y_max, point.y);
+  z_min = min(z_min, point.z);
+  z_max = max(z_max, point.z);
+
+}
+
+Vector BoundingBox::centroid() {
+
+  return Vector((x_min + x_max) * 0.5, (y_min + y_max) * 0.5, 
+      (z_min + z_max) * 0.5);
+
+}
+
+float BoundingBox::surface_area() {
+
+  // An empty box has no area
+  if (x_min > x_max || y_min > y_max || z_min > z_max) {
+    return 0;
   }
 
-  return true;
+  float dx = x_max - x_min;
+  float dy = y_max - y_min;
+  float dz = z_max - z_min;
+
+  return 2 * (dx * dy + dy * dz + dz * dx);
 
 }
 
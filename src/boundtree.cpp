@@ -1,349 +1,899 @@
+#include <algorithm>
 #include <limits>
+#include <stdio.h>
+#include <stdlib.h>
+#include <omp.h>
+#include <sys/mman.h>
 #include "boundtree.h"
 
+#ifndef TRIANGLEBLOCKS_H
+#include "triangleblocks.h"
+#endif
+
+#ifndef TRIANGLEMESH_H
+#include "trianglemesh.h"
+#endif
+
+#ifndef WIDETREE_H
+#include "widetree.h"
+#endif
+
 using namespace std;
 
 //*****************************************************************************
 // BoundingTree
 //*****************************************************************************
 
-// Quicksort algorithm that sorts shape by a certain axis
-vector<Shape*> BoundingTree::sort_shapes(vector<Shape*> shapes, int axis, 
-    bool check_max) {
+Shape* BoundingTree::intersect_object(Ray ray, Primitive skip) {
 
-  vector<Shape*> result(shapes);
+  HitRecord hit;
 
-  // Base case
-  if (shapes.size() <= 1) {
-    return result;
-  }
+  intersect_closest(ray, skip, &hit);
 
-  vector<Shape*> left_list;
-  vector<Shape*> right_list;
+  return hit.shape;
 
-  // Choose a pivot item v from I
+}
 
-  unsigned pivot_i = rand() % shapes.size();
-  Shape* pivot = shapes[pivot_i];
+// Finds the closest hit in one pass over the flattened tree. ray.t_max shrinks
+// to the best t found so far, so boxes further away than that are skipped, and
+// the nearer child of each node is visited first.
+bool BoundingTree::intersect_closest(Ray ray, Primitive skip, 
+    HitRecord* hit) {
 
-  for (unsigned i = 0; i < shapes.size(); i++) {
+  // Second children still to visit, with the distance to their boxes
+  int stack[BVH_STACK_SIZE];
+  float stack_t[BVH_STACK_SIZE];
+  int stack_size = 0;
 
-    if (i == pivot_i) {
-      continue;
-    }
+  int current = 0;
+  float t_entry;
 
-    // Partition I into two unsorted lists I1 and I2.
+  if (wide) {
+    return wide->intersect_closest(ray, skip, hit);
+  }
 
-    switch(axis) {
+  hit->shape = NULL;
 
-      // X-axis
-      case 0:
+  if (node_count == 0 || !nodes[0].bbox.intersect(ray, &t_entry)) {
+    return false;
+  }
 
-        if (check_max) {
+  while (true) {
 
-          if (shapes[i]->bbox.x_max < pivot->bbox.x_max) {
-            left_list.push_back(shapes[i]);
-          } else {
-            right_list.push_back(shapes[i]);
-          }
+    LinearNode* node = &nodes[current];
 
-        } else {
+    if (node->shape_count > 0) {
 
-          if (shapes[i]->bbox.x_min < pivot->bbox.x_min) {
-            left_list.push_back(shapes[i]);
-          } else {
-            right_list.push_back(shapes[i]);
-          }
+      blocks->intersect_leaf(node->offset, node->shape_count, ray, skip, hit);
 
+    } else {
+
+      int first = current + 1;
+      int second = node->offset;
+      float t_first;
+      float t_second;
+
+      bool hit_first = nodes[first].bbox.intersect(ray, &t_first);
+      bool hit_second = nodes[second].bbox.intersect(ray, &t_second);
+
+      if (hit_first && hit_second) {
+
+        // Go to the nearer child, and come back for the other one
+        if (t_second < t_first) {
+          swap(first, second);
+          swap(t_first, t_second);
         }
 
-        break;
+        stack[stack_size] = second;
+        stack_t[stack_size] = t_second;
+        stack_size++;
+        current = first;
+        continue;
+
+      } else if (hit_first) {
+        current = first;
+        continue;
+      } else if (hit_second) {
+        current = second;
+        continue;
+      }
+
+    }
+
+    // Pop the next subtree that could still hold something closer
+    while (stack_size > 0 && stack_t[stack_size - 1] > ray.t_max) {
+      stack_size--;
+    }
 
-      // Y-axis
-      case 1:
+    if (stack_size == 0) {
+      break;
+    }
 
-        if (check_max) {
+    current = stack[--stack_size];
 
-          if (shapes[i]->bbox.y_max < pivot->bbox.y_max) {
-            left_list.push_back(shapes[i]);
-          } else {
-            right_list.push_back(shapes[i]);
-          }
+  }
 
-        } else {
+  return hit->shape != NULL;
 
-          if (shapes[i]->bbox.y_min < pivot->bbox.y_min) {
-            left_list.push_back(shapes[i]);
-          } else {
-            right_list.push_back(shapes[i]);
-          }
+}
 
-        }
+// Any-hit query for shadow rays: stops at the first shape between t_min and
+// t_max, without caring whether it is the closest one
+bool BoundingTree::occluded(Ray ray, Primitive skip) {
 
-        break;
+  int stack[BVH_STACK_SIZE];
+  int stack_size = 0;
+  int current = 0;
+  float t_entry;
 
-      // Z-axis
-      case 2:
+  if (wide) {
+    return wide->occluded(ray, skip);
+  }
 
-        if (check_max) {
+  if (node_count == 0) {
+    return false;
+  }
 
-          if (shapes[i]->bbox.z_max < pivot->bbox.z_max) {
-            left_list.push_back(shapes[i]);
-          } else {
-            right_list.push_back(shapes[i]);
-          }
+  while (true) {
 
-        } else {
+    LinearNode* node = &nodes[current];
 
-          if (shapes[i]->bbox.z_min < pivot->bbox.z_min) {
-            left_list.push_back(shapes[i]);
-          } else {
-            right_list.push_back(shapes[i]);
-          }
+    if (node->bbox.intersect(ray, &t_entry)) {
 
+      if (node->shape_count > 0) {
+
+        if (blocks->occluded_leaf(node->offset, node->shape_count, ray, 
+            skip)) {
+          return true;
         }
 
-        break;
+      } else {
+
+        stack[stack_size++] = node->offset;
+        current = current + 1;
+        continue;
+
+      }
+
+    }
 
+    if (stack_size == 0) {
+      break;
     }
 
+    current = stack[--stack_size];
+
   }
 
-  // Sort left and right lists recursively
+  return false;
 
-  left_list = sort_shapes(left_list, axis, check_max);
-  right_list = sort_shapes(right_list, axis, check_max);
+}
 
-  // Concatenate S1, v, and S2 together, yielding a sorted list S.
+// Orders primitives by the far side of their bounding box along one axis
+class PrimitiveMaxCompare {
 
-  for (unsigned i = 0; i < shapes.size(); i++) {
-    if (i < left_list.size()) {
-      result[i] = left_list[i];
-    } else if (i == left_list.size()) {
-      result[i] = pivot;
-    } else {
-      result[i] = right_list[i - left_list.size() - 1];
+  public:
+
+    int axis;
+
+    PrimitiveMaxCompare(int compare_axis) {
+      axis = compare_axis;
     }
+
+    bool operator()(const PrimitiveInfo& a, const PrimitiveInfo& b) const {
+      switch (axis) {
+        case 0:
+          return a.bbox.x_max < b.bbox.x_max;
+        case 1:
+          return a.bbox.y_max < b.bbox.y_max;
+        default:
+          return a.bbox.z_max < b.bbox.z_max;
+      }
+    }
+
+};
+
+BoundingTree::BoundingTree() {
+
+  nodes = NULL;
+  node_count = 0;
+  depth = 0;
+  blocks = NULL;
+  wide = NULL;
+  mapping = NULL;
+  mapping_size = 0;
+  pool = NULL;
+  pool_used = 0;
+
+}
+
+// Hands out the next unused build node. A tree over n primitives never needs
+// more than 2n - 1 of them.
+BuildNode* BoundingTree::new_node() {
+
+  int index;
+
+  #pragma omp atomic capture
+  index = pool_used++;
+
+  BuildNode* node = &pool[index];
+
+  node->left_child = NULL;
+  node->right_child = NULL;
+  node->split_axis = 0;
+  node->leaf = false;
+
+  return node;
+
+}
+
+// Bounds of the primitives in [start, end) and of their centroids. Large ranges
+// are split into chunks that are bounded by separate tasks and then merged.
+void BoundingTree::compute_bounds(vector<PrimitiveInfo>& prims, int start, 
+    int end, BoundingBox* bbox, BoundingBox* centroid_bbox) {
+
+  int count = end - start;
+
+  bbox->reset();
+  centroid_bbox->reset();
+
+  if (count < BUILD_PARALLEL_THRESHOLD) {
+
+    for (int i = start; i < end; i++) {
+      bbox->expand(&prims[i].bbox);
+      centroid_bbox->expand(prims[i].bbox.centroid());
+    }
+
+    return;
+
+  }
+
+  BoundingBox chunk_bboxes[BUILD_CHUNKS];
+  BoundingBox chunk_centroids[BUILD_CHUNKS];
+
+  for (int c = 0; c < BUILD_CHUNKS; c++) {
+
+    #pragma omp task shared(prims, chunk_bboxes, chunk_centroids)
+    compute_bounds(prims, start + (long) count * c / BUILD_CHUNKS, 
+        start + (long) count * (c + 1) / BUILD_CHUNKS, &chunk_bboxes[c], 
+        &chunk_centroids[c]);
+
   }
 
-  return result;
+  #pragma omp taskwait
+
+  for (int c = 0; c < BUILD_CHUNKS; c++) {
+    bbox->expand(&chunk_bboxes[c]);
+    centroid_bbox->expand(&chunk_centroids[c]);
+  }
 
 }
 
-Shape* BoundingTree::intersect_object(Ray ray, Shape* shadow_shape) {
+// Adds the primitives in [start, end) to SAH_BINS centroid bins on each axis.
+// counts and bboxes hold the bins for x, then y, then z.
+void BoundingTree::bin_shapes(vector<PrimitiveInfo>& prims, int start, 
+    int end, BoundingBox* centroid_bbox, int* counts, BoundingBox* bboxes) {
+
+  float centroid_min[3] = {centroid_bbox->x_min, centroid_bbox->y_min, 
+      centroid_bbox->z_min};
+  float centroid_max[3] = {centroid_bbox->x_max, centroid_bbox->y_max, 
+      centroid_bbox->z_max};
 
-  // Return the shape that has the lowest t value and is intersected
-  Shape* temp;
-  Shape* closest_shape = NULL;
-  float best_t_value; 
+  for (int i = start; i < end; i++) {
 
-  // If there's only one shape, return it if it intersects
-  if (leaf) {
+    Vector centroid = prims[i].bbox.centroid();
+    float values[3] = {centroid.x, centroid.y, centroid.z};
+
+    for (int axis = 0; axis < 3; axis++) {
+
+      float extent = centroid_max[axis] - centroid_min[axis];
+
+      if (extent <= 0) {
+        continue;
+      }
+
+      int b = (int) (SAH_BINS * (values[axis] - centroid_min[axis]) / extent);
+      b = axis * SAH_BINS + min(b, SAH_BINS - 1);
+
+      counts[b]++;
+      bboxes[b].expand(&prims[i].bbox);
 
-    if (shape->intersect(ray) && (shape != shadow_shape)) {
-      closest_shape = shape;
     }
 
-  } else {
+  }
 
-    // If the ray actually intersects the box
-    if (bbox.intersect(ray)) {
-      // If there's an object in the left child that the ray intersects
-      if ((temp = left_child->intersect_object(ray, shadow_shape))) {
+}
 
-        // You can't hit yourself
-        if (temp != shadow_shape) {
-          // Explicitly avoid two recursive calls
-          closest_shape = temp;
-          best_t_value = closest_shape->intersectT(ray);
-        }
+// Finds the cheapest binned split of [start, end). Returns its cost, or 
+// infinity if the centroids cannot be separated on any axis.
+float BoundingTree::find_sah_split(vector<PrimitiveInfo>& prims, int start, 
+    int end, BoundingBox* bbox, BoundingBox* centroid_bbox, int* best_axis, 
+    int* best_bin) {
+
+  int count = end - start;
+  int counts[3 * SAH_BINS];
+  BoundingBox bboxes[3 * SAH_BINS];
+
+  for (int b = 0; b < 3 * SAH_BINS; b++) {
+    counts[b] = 0;
+    bboxes[b].reset();
+  }
+
+  if (count < BUILD_PARALLEL_THRESHOLD) {
 
-      } 
+    bin_shapes(prims, start, end, centroid_bbox, counts, bboxes);
 
-      // If there's an object in the right child that the ray intersects
-      if ((temp = right_child->intersect_object(ray, shadow_shape))) {
+  } else {
 
-        // Only if nothing hit on the left side closest shape, or the t_value
-        // here is better than the one on the left side
-        if (closest_shape == NULL || temp->intersectT(ray) <= best_t_value) {
+    // Near the root, bin chunks of the range in parallel and merge the bins
+    int chunk_counts[BUILD_CHUNKS][3 * SAH_BINS];
+    BoundingBox chunk_bboxes[BUILD_CHUNKS][3 * SAH_BINS];
 
-          // You can't hit yourself
-          if (temp != shadow_shape) {
-            closest_shape = temp;
-          }
+    for (int c = 0; c < BUILD_CHUNKS; c++) {
 
+      #pragma omp task shared(prims, chunk_counts, chunk_bboxes)
+      {
+        for (int b = 0; b < 3 * SAH_BINS; b++) {
+          chunk_counts[c][b] = 0;
+          chunk_bboxes[c][b].reset();
         }
-   
+
+        bin_shapes(prims, start + (long) count * c / BUILD_CHUNKS, 
+            start + (long) count * (c + 1) / BUILD_CHUNKS, centroid_bbox, 
+            chunk_counts[c], chunk_bboxes[c]);
       }
-    } 
+
+    }
+
+    #pragma omp taskwait
+
+    for (int c = 0; c < BUILD_CHUNKS; c++) {
+      for (int b = 0; b < 3 * SAH_BINS; b++) {
+        counts[b] += chunk_counts[c][b];
+        bboxes[b].expand(&chunk_bboxes[c][b]);
+      }
+    }
 
   }
 
-  return closest_shape;
+  float node_area = bbox->surface_area();
+  float best_cost = numeric_limits<float>::infinity();
 
-}
+  for (int axis = 0; axis < 3; axis++) {
+
+    int* axis_counts = &counts[axis * SAH_BINS];
+    BoundingBox* axis_bboxes = &bboxes[axis * SAH_BINS];
+
+    // Sweep from the right to get the area and count right of each plane
+    float right_areas[SAH_BINS];
+    int right_counts[SAH_BINS];
+    BoundingBox running;
+    int running_count = 0;
+
+    running.reset();
+
+    for (int b = SAH_BINS - 1; b > 0; b--) {
+      running.expand(&axis_bboxes[b]);
+      running_count += axis_counts[b];
+      right_areas[b] = running.surface_area();
+      right_counts[b] = running_count;
+    }
+
+    // Then sweep from the left, evaluating the split after each bin
+    running.reset();
+    running_count = 0;
 
-void BoundingTree::init_root_bbox(vector<Shape*> shapes) {
+    for (int b = 0; b < SAH_BINS - 1; b++) {
 
-  bbox.x_min = numeric_limits<float>::infinity();
-  bbox.x_max = -1 * numeric_limits<float>::infinity();
-  bbox.y_min = numeric_limits<float>::infinity();
-  bbox.y_max = -1 * numeric_limits<float>::infinity();
-  bbox.z_min = numeric_limits<float>::infinity();
-  bbox.z_max = -1 * numeric_limits<float>::infinity();
+      running.expand(&axis_bboxes[b]);
+      running_count += axis_counts[b];
+
+      if (running_count == 0 || right_counts[b + 1] == 0) {
+        continue;
+      }
+
+      float cost = SAH_TRAVERSAL_COST + SAH_INTERSECT_COST * 
+          (running.surface_area() * running_count + 
+          right_areas[b + 1] * right_counts[b + 1]) / node_area;
+
+      if (cost < best_cost) {
+        best_cost = cost;
+        *best_axis = axis;
+        *best_bin = b;
+      }
+
+    }
 
-  for (unsigned i = 0; i < shapes.size(); i++) {
-    bbox.x_min = min(bbox.x_min, shapes[i]->bbox.x_min);
-    bbox.x_max = max(bbox.x_max, shapes[i]->bbox.x_max);
-    bbox.y_min = min(bbox.y_min, shapes[i]->bbox.y_min);
-    bbox.y_max = max(bbox.y_max, shapes[i]->bbox.y_max);
-    bbox.z_min = min(bbox.z_min, shapes[i]->bbox.z_min);
-    bbox.z_max = max(bbox.z_max, shapes[i]->bbox.z_max);
   }
 
+  return best_cost;
+
 }
 
-void BoundingTree::init_child_bbox(BoundingBox* last_bbox) {
+// Whether a mesh's tree is among prims[start, end). It has to end up in a
+// leaf of its own, so such a range is split even when it would fit in one.
+bool BoundingTree::holds_subtree(vector<PrimitiveInfo>& prims, int start,
+    int end) {
 
-  bbox.x_min = last_bbox->x_min;
-  bbox.y_min = last_bbox->y_min;
-  bbox.z_min = last_bbox->z_min;
-  bbox.x_max = last_bbox->x_max;
-  bbox.y_max = last_bbox->y_max;
-  bbox.z_max = last_bbox->z_max;
+  for (int i = start; i < end; i++) {
+    if (prims[i].subtree) {
+      return true;
+    }
+  }
+
+  return false;
 
 }
 
-void BoundingTree::split_left_bbox(BoundingBox* last_bbox, 
-    vector<Shape*> shapes, int axis) {
+// Binned SAH construction over prims[start, end), for a node level levels
+// below the root. The range is partitioned in place so each child owns a
+// contiguous range of the same vector, and large subtrees are built as
+// separate tasks.
+BuildNode* BoundingTree::build_sah(vector<PrimitiveInfo>& prims, int start, 
+    int end, int level) {
 
-  switch(axis) {
-    case 0:
-      bbox.x_max = shapes.back()->bbox.x_max;
-      break;
+  BuildNode* node = new_node();
+  BoundingBox centroid_bbox;
 
-    case 1:
-      bbox.y_max = shapes.back()->bbox.y_max;
-      break;
+  int count = end - start;
 
-    case 2:
-      bbox.z_max = shapes.back()->bbox.z_max;
-      break;
+  compute_bounds(prims, start, end, &node->bbox, &centroid_bbox);
+
+  node->first_shape = start;
+  node->shape_count = count;
+
+  if (count <= 1) {
+    node->leaf = true;
+    return node;
   }
 
+  int best_axis = -1;
+  int best_bin = 0;
+  float best_cost = 0;
+
+  if (level < BVH_SAH_MAX_DEPTH) {
+    best_cost = find_sah_split(prims, start, end, &node->bbox, 
+        &centroid_bbox, &best_axis, &best_bin);
+  }
+
+  int mid;
+
+  if (level >= BVH_SAH_MAX_DEPTH) {
+
+    // Too deep for the SAH's uneven splits, so halve the range along the
+    // widest spread of centroids to keep the traversal stack bounded
+    if (count <= leaf_size && !holds_subtree(prims, start, end)) {
+      node->leaf = true;
+      return node;
+    }
+
+    float extents[3] = {centroid_bbox.x_max - centroid_bbox.x_min,
+        centroid_bbox.y_max - centroid_bbox.y_min,
+        centroid_bbox.z_max - centroid_bbox.z_min};
+
+    best_axis = 0;
+
+    for (int axis = 1; axis < 3; axis++) {
+      if (extents[axis] > extents[best_axis]) {
+        best_axis = axis;
+      }
+    }
+
+    mid = start + count / 2;
+    nth_element(prims.begin() + start, prims.begin() + mid, 
+        prims.begin() + end, PrimitiveMaxCompare(best_axis));
+
+  } else if (best_axis == -1) {
+
+    // All centroids coincide, so fall back to splitting the range in half
+    if (count <= leaf_size && !holds_subtree(prims, start, end)) {
+      node->leaf = true;
+      return node;
+    }
+
+    mid = start + count / 2;
+
+  } else {
+
+    // Stop when intersecting everything is cheaper than splitting
+    if (count <= leaf_size && count * SAH_INTERSECT_COST <= best_cost &&
+        !holds_subtree(prims, start, end)) {
+      node->leaf = true;
+      return node;
+    }
+
+    float centroid_min[3] = {centroid_bbox.x_min, centroid_bbox.y_min, 
+        centroid_bbox.z_min};
+    float centroid_max[3] = {centroid_bbox.x_max, centroid_bbox.y_max, 
+        centroid_bbox.z_max};
+    float extent = centroid_max[best_axis] - centroid_min[best_axis];
+
+    // Partition the range so primitives in bins <= best_bin come first
+    int i = start;
+    int j = end - 1;
+
+    while (i <= j) {
+
+      Vector centroid = prims[i].bbox.centroid();
+      float value = (best_axis == 0) ? centroid.x : 
+          (best_axis == 1) ? centroid.y : centroid.z;
+      int b = (int) (SAH_BINS * (value - centroid_min[best_axis]) / extent);
+      b = min(b, SAH_BINS - 1);
+
+      if (b <= best_bin) {
+        i++;
+      } else {
+        swap(prims[i], prims[j]);
+        j--;
+      }
+
+    }
+
+    mid = i;
+
+  }
+
+  node->leaf = false;
+  node->split_axis = max(best_axis, 0);
+
+  #pragma omp task shared(prims) if (count > BUILD_TASK_THRESHOLD)
+  node->left_child = build_sah(prims, start, mid, level + 1);
+
+  node->right_child = build_sah(prims, mid, end, level + 1);
+
+  #pragma omp taskwait
+
+  return node;
+
 }
 
-void BoundingTree::split_right_bbox(BoundingBox* last_bbox, 
-    vector<Shape*> shapes, int axis) {
+// Object median construction over prims[start, end), splitting on a
+// round-robin axis. nth_element partitions the range in place, so nothing
+// is copied or fully sorted.
+BuildNode* BoundingTree::build_median(vector<PrimitiveInfo>& prims, 
+    int start, int end, int axis) {
 
-  vector<Shape*> sorted = sort_shapes(shapes, axis, false);
+  BuildNode* node = new_node();
+  BoundingBox centroid_bbox;
 
-  switch(axis) {
-    case 0:
-      bbox.x_min = sorted.front()->bbox.x_min;
-      break;
+  int count = end - start;
 
-    case 1:
-      bbox.y_min = sorted.front()->bbox.y_min;
-      break;
+  compute_bounds(prims, start, end, &node->bbox, &centroid_bbox);
 
-    case 2:
-      bbox.z_min = sorted.front()->bbox.z_min;
-      break;
+  node->split_axis = axis;
+  node->first_shape = start;
+  node->shape_count = count;
+
+  // Base case (only one shape)
+  if (count <= 1) {
+    node->leaf = true;
+    return node;
   }
 
+  int mid = start + count / 2;
+
+  // Left child contains the half of the primitives that end first along the axis
+  nth_element(prims.begin() + start, prims.begin() + mid, 
+      prims.begin() + end, PrimitiveMaxCompare(axis));
+
+  node->leaf = false;
+
+  #pragma omp task shared(prims) if (count > BUILD_TASK_THRESHOLD)
+  node->left_child = build_median(prims, start, mid, (axis + 1) % 3);
+
+  node->right_child = build_median(prims, mid, end, (axis + 1) % 3);
+
+  #pragma omp taskwait
+
+  return node;
+
 }
 
-void BoundingTree::create_bounding_box(vector<Shape*> shapes, 
-    BoundingBox *last_bbox, int axis, bool left) {
+// Builds the tree over every primitive of shapes and every face of meshes.
+// Each mesh brings the tree build_mesh made for it, or that its cache held,
+// which is sorted as a single primitive and then spliced in whole, so none
+// of a mesh is rebuilt or repacked here. The meshes' trees are gone after.
+BoundingTree* BoundingTree::build(vector<Shape*> shapes,
+    vector<TriangleMesh*>& meshes) {
 
-  if (last_bbox) {
+  BoundingTree* tree = new BoundingTree();
+  double start_time = omp_get_wtime();
 
-    init_child_bbox(last_bbox);
+  vector<PrimitiveInfo> prims = gather_primitives(shapes);
 
-    // Use the old axis to create the bounding box
-    if (left) {
-      split_left_bbox(last_bbox, shapes, axis);
-    } else {
-      split_right_bbox(last_bbox, shapes, axis);
+  for (unsigned int i = 0; i < meshes.size(); i++) {
+
+    BoundingTree* subtree = meshes[i]->tree;
+
+    // A mesh without faces has nothing to trace
+    if (subtree->node_count == 0) {
+      continue;
     }
 
-  } else {
+    PrimitiveInfo info;
+    info.bbox = subtree->nodes[0].bbox;
+    info.primitive = Primitive(meshes[i], -1);
+    info.id = prims.size();
+    info.subtree = subtree;
 
-    init_root_bbox(shapes);
+    prims.push_back(info);
 
   }
 
+  tree->build_nodes(prims);
+
+  // The builders and the caches keep within the traversal stack
+  if (tree->depth > BVH_STACK_SIZE) {
+    fprintf(stderr, "Tree is %d levels deep, more than the traversal stack "
+        "holds\n", tree->depth);
+    exit(EXIT_FAILURE);
+  }
+
+  tree->blocks = new TriangleBlocks(tree, block_width());
+
+  for (unsigned int i = 0; i < meshes.size(); i++) {
+    meshes[i]->tree->dispose();
+    meshes[i]->tree = NULL;
+  }
+
+  tree->subtrees.clear();
+
+  if (width > 2) {
+
+    tree->wide = new WideTree(tree, width);
+
+    // Collapsing can stack more children per level than the binary tree, so
+    // trace that instead if the wide traversal could overflow
+    if (tree->wide->stack_depth > WIDE_STACK_SIZE) {
+      fprintf(stderr, "Wide tree needs a stack of %d, tracing the binary tree "
+          "instead\n", tree->wide->stack_depth);
+      tree->wide->dispose();
+      tree->wide = NULL;
+    }
+
+  }
+
+  printf("Build time: %fs\n", omp_get_wtime() - start_time);
+  printf("SAH cost (%s): %f\n", (method == SAH) ? "sah" : "median", 
+      tree->sah_cost());
+
+  if (tree->wide) {
+    printf("Wide tree: %d nodes of width %d\n", tree->wide->node_count, width);
+  }
+
+  return tree;
+
 }
 
-BoundingTree::BoundingTree() {
+// Builds the tree over the faces of one mesh, with its triangles packed
+BoundingTree* BoundingTree::build_mesh(TriangleMesh* mesh) {
 
-  leaf = false;
-  shape = NULL;
-  left_child = NULL;
-  right_child = NULL;
+  BoundingTree* tree = new BoundingTree();
+  vector<Shape*> shapes(1, mesh);
+
+  vector<PrimitiveInfo> prims = gather_primitives(shapes);
+
+  tree->build_nodes(prims);
+  tree->blocks = new TriangleBlocks(tree, block_width());
+
+  return tree;
 
 }
 
-BoundingTree::BoundingTree(vector<Shape*> shapes, BoundingBox* last_bbox, 
-    int axis, bool left) {
+// Leaves are packed as wide as they can get, so a leaf is one or two blocks
+int BoundingTree::block_width() {
 
-  /* Base cases */
+  return (leaf_size > 4) ? 8 : 4;
+
+}
+
+// Lists every primitive of shapes, in scene order, with its bounds
+vector<PrimitiveInfo> BoundingTree::gather_primitives(vector<Shape*>& shapes) {
+
+  vector<PrimitiveInfo> prims;
+
+  for (unsigned int i = 0; i < shapes.size(); i++) {
+
+    int count = shapes[i]->primitive_count();
+
+    for (int j = 0; j < count; j++) {
+
+      PrimitiveInfo info;
+      info.bbox = shapes[i]->primitive_bbox(j);
+      info.primitive = Primitive(shapes[i], j);
+      info.id = prims.size();
+      info.subtree = NULL;
+
+      prims.push_back(info);
+
+    }
 
-  // In the rare case that nothing is being traced at all
-  if (shapes.size() == 0) {
-    shape = NULL;
-    leaf = true;
-    return;
   }
 
-  // Base case (only one shape)
-  if (shapes.size() == 1) {
-    shape = shapes[0];
-    leaf = true;
-    return;
+  return prims;
+
+}
+
+// Builds and flattens the tree over prims, which are left in the order the
+// leaves refer to them
+void BoundingTree::build_nodes(vector<PrimitiveInfo>& prims) {
+
+  BuildNode* root;
+
+  int count = prims.size();
+
+  pool = (BuildNode*) malloc(max(2 * count - 1, 1) * sizeof(BuildNode));
+
+  // One thread starts the build, and the others pick up subtrees as tasks
+  #pragma omp parallel
+  {
+    #pragma omp single
+    {
+      if (method == SAH) {
+        root = build_sah(prims, 0, count, 0);
+      } else {
+        root = build_median(prims, 0, count, 0);
+      }
+    }
+  }
+
+  flatten(root, prims);
+
+  free(pool);
+  pool = NULL;
+
+}
+
+// Expected cost of a random ray through the tree, relative to the root box
+float BoundingTree::sah_cost() {
+
+  if (node_count == 0) {
+    return 0;
+  }
+
+  float root_area = nodes[0].bbox.surface_area();
+
+  if (root_area <= 0) {
+    return 0;
+  }
+
+  float cost = 0;
+
+  for (int i = 0; i < node_count; i++) {
+
+    float area = nodes[i].bbox.surface_area() / root_area;
+
+    if (nodes[i].shape_count > 0) {
+      cost += area * SAH_INTERSECT_COST * nodes[i].shape_count;
+    } else {
+      cost += area * SAH_TRAVERSAL_COST;
+    }
+
+  }
+
+  return cost;
+
+}
+
+// Copies the subtree, level levels below the root, into nodes[*offset...] in
+// depth-first order, and returns the index it was written to. A leaf holding
+// a mesh is replaced by the mesh's nodes. Keeps depth up to date on the way.
+int BoundingTree::flatten_node(BuildNode* node, vector<PrimitiveInfo>& prims,
+    vector<int>& first_prims, int* offset, int level) {
+
+  int index = (*offset)++;
+  LinearNode* linear = &nodes[index];
+
+  depth = max(depth, level);
+
+  if (node->leaf && prims[node->first_shape].subtree) {
+
+    BoundingTree* subtree = prims[node->first_shape].subtree;
+    int first_prim = first_prims[node->first_shape];
+
+    // Its offsets were relative to its own nodes and faces
+    for (int i = 0; i < subtree->node_count; i++) {
+
+      nodes[index + i] = subtree->nodes[i];
+
+      if (nodes[index + i].shape_count > 0) {
+        nodes[index + i].offset += first_prim;
+      } else {
+        nodes[index + i].offset += index;
+      }
+
+    }
+
+    *offset += subtree->node_count - 1;
+    depth = max(depth, level + subtree->depth);
+
+    return index;
+
   }
 
-  /* Declarations */
+  linear->bbox = node->bbox;
+  linear->axis = node->split_axis;
+  linear->pad = 0;
 
-  vector<Shape*> sorted_shapes;
-  vector<Shape*> left_shapes;
-  vector<Shape*> right_shapes;
+  if (node->leaf) {
 
-  leaf = false;
-  shape = NULL;
+    linear->offset = first_prims[node->first_shape];
+    linear->shape_count = node->shape_count;
 
-  // Create the bounding box for the node (use the previous axis);
-  create_bounding_box(shapes, last_bbox, (axis + 2) % 3, left);
+  } else {
 
-  sorted_shapes = sort_shapes(shapes, axis, true);
+    linear->shape_count = 0;
+    flatten_node(node->left_child, prims, first_prims, offset, level + 1);
+    linear->offset = flatten_node(node->right_child, prims, first_prims,
+        offset, level + 1);
 
-  // Left children contains half of the shapes
-  for (unsigned i = 0; i < shapes.size() / 2; i++) {
-    left_shapes.push_back(sorted_shapes[i]);
   }
 
-  // Right child contains the other half of the shapes
-  for (unsigned i = shapes.size() / 2; i < shapes.size(); i++) {
-    right_shapes.push_back(sorted_shapes[i]);
+  return index;
+
+}
+
+// Compacts the build nodes under root into one contiguous node array, and
+// lists the primitives in the left to right order its leaves refer to them.
+// Leaves own contiguous ranges of the partitioned prims, and a mesh's faces
+// take up as many places as its own tree orders them in.
+void BoundingTree::flatten(BuildNode* root, vector<PrimitiveInfo>& prims) {
+
+  int offset = 0;
+  int count = prims.size();
+
+  // Nothing to trace, so leave the tree without any nodes
+  if (root->leaf && root->shape_count == 0) {
+    node_count = 0;
+    return;
   }
 
-  // Increment axes
-  axis = (axis + 1) % 3;
+  vector<int> first_prims(count);
+  node_count = pool_used;
+
+  for (int i = 0; i < count; i++) {
+
+    BoundingTree* subtree = prims[i].subtree;
+
+    first_prims[i] = ordered_prims.size();
+
+    if (subtree) {
+      subtrees.push_back(subtree);
+      subtree_offsets.push_back(first_prims[i]);
+      ordered_prims.insert(ordered_prims.end(), subtree->ordered_prims.begin(),
+          subtree->ordered_prims.end());
+      node_count += subtree->node_count - 1;
+    } else {
+      ordered_prims.push_back(prims[i].primitive);
+    }
+
+  }
 
-  // Construct Left Child
-  left_child = new BoundingTree(left_shapes, &bbox, axis, true);
+  // Keep pairs of nodes on a single cache line
+  if (posix_memalign((void**) &nodes, 64, node_count * sizeof(LinearNode))) {
+    fprintf(stderr, "Could not allocate %d tree nodes\n", node_count);
+    exit(EXIT_FAILURE);
+  }
 
-  // Construct Right Child
-  right_child = new BoundingTree(right_shapes, &bbox, axis, false); 
+  depth = 0;
+  flatten_node(root, prims, first_prims, &offset, 0);
 
 }
 
 void BoundingTree::dispose() {
 
-  if (!leaf) {
-    left_child->dispose();
-    right_child->dispose();
+  if (mapping) {
+    munmap(mapping, mapping_size);
+  } else if (nodes) {
+    free(nodes);
+  }
+
+  if (blocks) {
+    blocks->dispose();
+  }
+
+  if (wide) {
+    wide->dispose();
   }
 
   delete this;
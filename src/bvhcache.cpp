@@ -0,0 +1,291 @@
+#include <algorithm>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bvhcache.h"
+
+#ifndef HASH_H
+#include "hash.h"
+#endif
+
+#ifndef TRIANGLEBLOCKS_H
+#include "triangleblocks.h"
+#endif
+
+using namespace std;
+
+//*****************************************************************************
+// BVHCache
+//*****************************************************************************
+
+// Copies count items of type T out of the mapping into array, moving on
+template <class T>
+static void read_array(char** position, vector<T>& array, int count) {
+
+  array.assign((T*) *position, (T*) *position + count);
+  *position += count * sizeof(T);
+
+}
+
+template <class T>
+static bool write_array(FILE* file, const T* array, int count) {
+
+  return count == 0 || fwrite(array, sizeof(T), count, file) == (size_t) count;
+
+}
+
+// Hashes everything the mesh's tree depends on: the .obj file's contents,
+// the transform its vertices go through, and the build settings
+unsigned long long BVHCache::key(unsigned long long contents, 
+    const Matrix& transform) {
+
+  int settings[2] = {BoundingTree::method, BoundingTree::leaf_size};
+
+  unsigned long long hash = Hash::bytes(contents, &transform, 
+      sizeof(transform));
+
+  return Hash::bytes(hash, settings, sizeof(settings));
+
+}
+
+// Maps the cache file and, if it was written for the same file, transform
+// and settings, fills the mesh and its tree in from it. The tree's nodes
+// point straight into the mapping; everything else is copied out.
+bool BVHCache::load(TriangleMesh* mesh, string path, unsigned long long key) {
+
+  int file = open(path.c_str(), O_RDONLY);
+
+  if (file < 0) {
+    return false;
+  }
+
+  struct stat info;
+
+  if (fstat(file, &info) != 0 || info.st_size < (off_t) sizeof(CacheHeader)) {
+    close(file);
+    return false;
+  }
+
+  size_t size = info.st_size;
+  void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, file, 0);
+  close(file);
+
+  if (mapping == MAP_FAILED) {
+    return false;
+  }
+
+  CacheHeader* header = (CacheHeader*) mapping;
+  int width = header->block_width;
+
+  bool valid = header->magic == BVH_CACHE_MAGIC &&
+      header->version == BVH_CACHE_VERSION && header->key == key &&
+      header->node_count > 0 && header->face_count > 0 &&
+      header->vertex_count >= 0 && header->normal_count > 0 &&
+      header->tcoord_count > 0 && header->block_count >= 0 &&
+      width == BoundingTree::block_width() && header->flat_faces >= 0;
+
+  // Flat faces are wound towards the camera they were read for
+  if (valid && header->flat_faces > 0) {
+    valid = mesh->view_origin.x == header->view_origin[0] &&
+        mesh->view_origin.y == header->view_origin[1] &&
+        mesh->view_origin.z == header->view_origin[2];
+  }
+
+  int faces = header->face_count;
+
+  valid = valid && size == sizeof(CacheHeader) +
+      header->node_count * sizeof(LinearNode) + faces * sizeof(int) +
+      (size_t) header->block_count * width * (TRIANGLE_BLOCK_ROWS *
+          sizeof(float) + sizeof(int)) + faces * sizeof(int) +
+      (header->vertex_count + header->normal_count + header->tcoord_count) *
+          sizeof(Vector) + 9 * faces * sizeof(int);
+
+  if (!valid) {
+    munmap(mapping, size);
+    return false;
+  }
+
+  LinearNode* nodes = (LinearNode*) (header + 1);
+  int* order = (int*) (nodes + header->node_count);
+  float* data = (float*) (order + faces);
+  int* lanes = (int*) (data + header->block_count * TRIANGLE_BLOCK_ROWS * 
+      width);
+  int* leaf_blocks = lanes + header->block_count * width;
+  char* position = (char*) (leaf_blocks + faces);
+
+  // Never trust offsets from disk further than the arrays they index. Both
+  // children of a node come after it, so one pass in order measures how
+  // deep the nodes really go, which the traversal stack has to hold.
+  vector<int> levels(header->node_count, 0);
+  int depth = 0;
+
+  for (int i = 0; valid && i < header->node_count; i++) {
+
+    LinearNode* node = &nodes[i];
+
+    depth = max(depth, levels[i]);
+
+    if (node->shape_count == 0) {
+
+      valid = node->offset > i && node->offset < header->node_count;
+
+      if (valid) {
+        levels[i + 1] = max(levels[i + 1], levels[i] + 1);
+        levels[node->offset] = max(levels[node->offset], levels[i] + 1);
+      }
+
+      continue;
+
+    }
+
+    valid = node->offset >= 0 && node->offset + node->shape_count <= faces;
+
+    int block = valid ? leaf_blocks[node->offset] : -1;
+
+    if (block >= 0) {
+      valid = block + (node->shape_count + width - 1) / width <= 
+          header->block_count;
+    }
+
+  }
+
+  valid = valid && depth <= BVH_MAX_DEPTH && depth == header->depth;
+
+  for (int i = 0; valid && i < faces; i++) {
+    valid = order[i] >= 0 && order[i] < faces && leaf_blocks[i] >= -1 &&
+        leaf_blocks[i] < header->block_count;
+  }
+
+  for (int i = 0; valid && i < header->block_count * width; i++) {
+    valid = lanes[i] >= -1 && lanes[i] < faces;
+  }
+
+  int* indices = (int*) (position + (header->vertex_count + 
+      header->normal_count + header->tcoord_count) * sizeof(Vector));
+  int counts[3] = {header->vertex_count, header->normal_count, 
+      header->tcoord_count};
+
+  for (int i = 0; valid && i < 9 * faces; i++) {
+    valid = indices[i] >= 0 && indices[i] < counts[i / (3 * faces)];
+  }
+
+  if (!valid) {
+    munmap(mapping, size);
+    return false;
+  }
+
+  read_array(&position, mesh->vertices, header->vertex_count);
+  read_array(&position, mesh->normals, header->normal_count);
+  read_array(&position, mesh->tcoords, header->tcoord_count);
+  read_array(&position, mesh->vertex_indices, 3 * faces);
+  read_array(&position, mesh->normal_indices, 3 * faces);
+  read_array(&position, mesh->tcoord_indices, 3 * faces);
+
+  BoundingTree* tree = new BoundingTree();
+
+  tree->nodes = nodes;
+  tree->node_count = header->node_count;
+  tree->depth = header->depth;
+  tree->mapping = mapping;
+  tree->mapping_size = size;
+
+  tree->ordered_prims.resize(faces);
+
+  for (int i = 0; i < faces; i++) {
+    tree->ordered_prims[i] = Primitive(mesh, order[i]);
+  }
+
+  TriangleBlocks* blocks = new TriangleBlocks(&tree->ordered_prims, width,
+      header->block_count);
+
+  memcpy(blocks->data, data, header->block_count * TRIANGLE_BLOCK_ROWS *
+      width * sizeof(float));
+  memcpy(blocks->lanes, lanes, header->block_count * width * sizeof(int));
+  memcpy(blocks->leaf_blocks, leaf_blocks, faces * sizeof(int));
+
+  tree->blocks = blocks;
+
+  // The root bounds every face, as adding them one by one would have
+  mesh->bbox = nodes[0].bbox;
+  mesh->tree = tree;
+
+  return true;
+
+}
+
+// Writes the mesh's tree, the face its leaves refer to at each place, its
+// packed triangles and the mesh itself. The file is renamed into place, so
+// a reader never sees half of it.
+bool BVHCache::save(TriangleMesh* mesh, string path, unsigned long long key) {
+
+  BoundingTree* tree = mesh->tree;
+  TriangleBlocks* blocks = tree->blocks;
+  int faces = mesh->face_count();
+
+  if (tree->node_count == 0) {
+    return false;
+  }
+
+  vector<int> order(faces);
+  int flat_faces = 0;
+
+  for (int i = 0; i < faces; i++) {
+    order[i] = tree->ordered_prims[i].index;
+    flat_faces += mesh->flat_face(i);
+  }
+
+  CacheHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = BVH_CACHE_MAGIC;
+  header.version = BVH_CACHE_VERSION;
+  header.key = key;
+  header.node_count = tree->node_count;
+  header.face_count = faces;
+  header.vertex_count = mesh->vertices.size();
+  header.normal_count = mesh->normals.size();
+  header.tcoord_count = mesh->tcoords.size();
+  header.block_count = blocks->block_count;
+  header.block_width = blocks->width;
+  header.depth = tree->depth;
+  header.flat_faces = flat_faces;
+  header.view_origin[0] = mesh->view_origin.x;
+  header.view_origin[1] = mesh->view_origin.y;
+  header.view_origin[2] = mesh->view_origin.z;
+
+  string temp_path = path + ".tmp";
+  FILE* file = fopen(temp_path.c_str(), "wb");
+
+  if (file == NULL) {
+    return false;
+  }
+
+  int lane_count = blocks->block_count * blocks->width;
+
+  bool success =
+      fwrite(&header, sizeof(header), 1, file) == 1 &&
+      write_array(file, tree->nodes, tree->node_count) &&
+      write_array(file, &order[0], faces) &&
+      write_array(file, blocks->data, lane_count * TRIANGLE_BLOCK_ROWS) &&
+      write_array(file, blocks->lanes, lane_count) &&
+      write_array(file, blocks->leaf_blocks, faces) &&
+      write_array(file, &mesh->vertices[0], header.vertex_count) &&
+      write_array(file, &mesh->normals[0], header.normal_count) &&
+      write_array(file, &mesh->tcoords[0], header.tcoord_count) &&
+      write_array(file, &mesh->vertex_indices[0], 3 * faces) &&
+      write_array(file, &mesh->normal_indices[0], 3 * faces) &&
+      write_array(file, &mesh->tcoord_indices[0], 3 * faces);
+
+  success = (fclose(file) == 0) && success;
+
+  if (!success || rename(temp_path.c_str(), path.c_str()) != 0) {
+    remove(temp_path.c_str());
+    return false;
+  }
+
+  return true;
+
+}
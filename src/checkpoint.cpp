@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "checkpoint.h"
+
+#ifndef SAMPLER_H
+#include "sampler.h"
+#endif
+
+#ifndef SCENE_H
+#include "scene.h"
+#endif
+
+#ifndef TILESCHEDULER_H
+#include "tilescheduler.h"
+#endif
+
+using namespace std;
+
+//*****************************************************************************
+// Checkpoint
+//*****************************************************************************
+
+// Fills in the scene and settings the current render is using
+static void describe_render(CheckpointHeader* header, Film* film,
+    unsigned long long identity, int tile_count) {
+
+  memset(header, 0, sizeof(CheckpointHeader));
+  header->magic = CHECKPOINT_MAGIC;
+  header->version = CHECKPOINT_VERSION;
+  header->identity = identity;
+  header->width = film->width;
+  header->height = film->height;
+  header->samples = Sampler::samples;
+  header->strategy = Sampler::strategy;
+  header->max_samples = Sampler::max_samples;
+  header->max_error = Sampler::max_error;
+  header->tile_size = TileScheduler::tile_size;
+  header->tile_count = tile_count;
+  header->passes = Scene::passes;
+
+}
+
+// Reads a checkpoint written for the same scene and render settings back
+// into film. Returns the pass it was written in, and which of that pass'
+// tiles were done. done must already hold one entry per tile.
+bool Checkpoint::load(Film* film, unsigned long long identity, string path,
+    int* pass, vector<char>& done) {
+
+  FILE* file = fopen(path.c_str(), "rb");
+
+  if (file == NULL) {
+    return false;
+  }
+
+  CheckpointHeader expected;
+  CheckpointHeader header;
+  describe_render(&expected, film, identity, done.size());
+
+  int pixels = film->width * film->height;
+  int radiance = film->radiance ? 3 * pixels : 0;
+  int squares = film->luminance_squares ? pixels : 0;
+  int tile_count = done.size();
+
+  bool success =
+      fread(&header, sizeof(header), 1, file) == 1 &&
+      header.magic == expected.magic && header.version == expected.version &&
+      header.identity == expected.identity &&
+      header.width == expected.width && header.height == expected.height &&
+      header.samples == expected.samples &&
+      header.strategy == expected.strategy &&
+      header.max_samples == expected.max_samples &&
+      header.max_error == expected.max_error &&
+      header.tile_size == expected.tile_size &&
+      header.tile_count == expected.tile_count &&
+      header.passes == expected.passes && header.pass >= 0 &&
+      header.pass < header.passes &&
+      fread(&done[0], 1, tile_count, file) == (size_t) tile_count &&
+      fread(film->accumulation, sizeof(float), 3 * pixels, file) ==
+          (size_t) 3 * pixels &&
+      fread(film->sample_counts, sizeof(int), pixels, file) ==
+          (size_t) pixels &&
+      fread(film->radiance, sizeof(float), radiance, file) ==
+          (size_t) radiance &&
+      fread(film->luminance_squares, sizeof(double), squares, file) ==
+          (size_t) squares &&
+      fgetc(file) == EOF;
+
+  fclose(file);
+
+  if (!success) {
+    return false;
+  }
+
+  *pass = header.pass;
+
+  return true;
+
+}
+
+// Copies the film, and which tiles are done in pass. The buffers are only
+// allocated the first time.
+void Checkpoint::capture(Film* film, unsigned long long identity, int pass,
+    vector<char>& tiles_done) {
+
+  describe_render(&header, film, identity, tiles_done.size());
+  header.pass = pass;
+
+  int pixels = film->width * film->height;
+
+  done = tiles_done;
+  accumulation.assign(film->accumulation, film->accumulation + 3 * pixels);
+  sample_counts.assign(film->sample_counts, film->sample_counts + pixels);
+
+  if (film->radiance) {
+    radiance.assign(film->radiance, film->radiance + 3 * pixels);
+  }
+
+  if (film->luminance_squares) {
+    luminance_squares.assign(film->luminance_squares,
+        film->luminance_squares + pixels);
+  }
+
+}
+
+// Writes the captured copy. The file is renamed into place, so a killed
+// render never leaves half a checkpoint behind.
+bool Checkpoint::save(string path) {
+
+  string temp_path = path + ".tmp";
+  FILE* file = fopen(temp_path.c_str(), "wb");
+
+  if (file == NULL) {
+    return false;
+  }
+
+  bool success =
+      fwrite(&header, sizeof(header), 1, file) == 1 &&
+      fwrite(&done[0], 1, done.size(), file) == done.size() &&
+      fwrite(&accumulation[0], sizeof(float), accumulation.size(), file) ==
+          accumulation.size() &&
+      fwrite(&sample_counts[0], sizeof(int), sample_counts.size(), file) ==
+          sample_counts.size() &&
+      (radiance.empty() ||
+          fwrite(&radiance[0], sizeof(float), radiance.size(), file) ==
+              radiance.size()) &&
+      (luminance_squares.empty() ||
+          fwrite(&luminance_squares[0], sizeof(double),
+              luminance_squares.size(), file) == luminance_squares.size());
+
+  success = (fclose(file) == 0) && success;
+
+  if (!success || rename(temp_path.c_str(), path.c_str()) != 0) {
+    remove(temp_path.c_str());
+    return false;
+  }
+
+  return true;
+
+}
@@ -1,33 +1,354 @@
+#include <algorithm>
+#include <omp.h>
+
 #include "film.h"
 
+#ifndef SAMPLER_H
+#include "sampler.h"
+#endif
+
+
+//*****************************************************************************
+// PixelSamples
+//*****************************************************************************
+
+PixelSamples::PixelSamples() {
+
+  luminance_squares = 0;
+  count = 0;
+
+}
+
+void PixelSamples::add(const PixelSamples& samples) {
+
+  color_sum += samples.color_sum;
+  radiance_sum += samples.radiance_sum;
+  luminance_squares += samples.luminance_squares;
+  count += samples.count;
+
+}
+
+// Standard error of the mean luminance of the samples
+double PixelSamples::error() {
+
+  if (count < 2) {
+    return INFINITY;
+  }
+
+  double mean = Film::luminance(color_sum / count);
+  double variance = (luminance_squares - count * mean * mean) / (count - 1);
+
+  return sqrt(fmax(variance, 0) / count);
+
+}
+
 //*****************************************************************************
 // Film
 //*****************************************************************************
 
+double Film::luminance(const Vector& color) {
+
+  return 0.2126 * color.x + 0.7152 * color.y + 0.0722 * color.z;
+
+}
+
+// Adds samples to pixel (x, y)
+void Film::add_samples(int x, int y, const PixelSamples& samples) {
+
+  if (streaming) {
+    set_pixel(x, y, samples.color_sum / samples.count);
+    streamed_samples += samples.count;
+    return;
+  }
+
+  size_t p = (size_t) y * width + x;
+
+  accumulation[3 * p + 0] += samples.color_sum.x;
+  accumulation[3 * p + 1] += samples.color_sum.y;
+  accumulation[3 * p + 2] += samples.color_sum.z;
+
+  if (radiance) {
+    radiance[3 * p + 0] += samples.radiance_sum.x;
+    radiance[3 * p + 1] += samples.radiance_sum.y;
+    radiance[3 * p + 2] += samples.radiance_sum.z;
+  }
+
+  if (luminance_squares) {
+    luminance_squares[p] += samples.luminance_squares;
+  }
+
+  sample_counts[p] += samples.count;
+
+}
+
+// Every sample of pixel (x, y) so far. A streamed pixel has none until it
+// is finished, and is gone after.
+PixelSamples Film::get_samples(int x, int y) {
+
+  size_t p = (size_t) y * width + x;
+  PixelSamples samples;
+
+  if (streaming) {
+    return samples;
+  }
+
+  samples.color_sum = Vector(accumulation[3 * p + 0], accumulation[3 * p + 1],
+      accumulation[3 * p + 2]);
+
+  if (radiance) {
+    samples.radiance_sum = Vector(radiance[3 * p + 0], radiance[3 * p + 1],
+        radiance[3 * p + 2]);
+  }
+
+  samples.luminance_squares = luminance_squares ? luminance_squares[p] : 0;
+  samples.count = sample_counts[p];
+
+  return samples;
+
+}
+
+// Mean of the samples of pixel (x, y) so far
+Vector Film::get_color(int x, int y) {
+
+  PixelSamples samples = get_samples(x, y);
+
+  if (samples.count == 0) {
+    return Vector();
+  }
+
+  return samples.color_sum / samples.count;
+
+}
+
+double Film::average_samples() {
+
+  double total = streamed_samples;
+
+  for (int p = 0; !streaming && p < width * height; p++) {
+    total += sample_counts[p];
+  }
+
+  return (width > 0 && height > 0) ? total / (width * height) : 0;
+
+}
+
 void Film::set_pixel(int x, int y, Vector color) {
+
+  unsigned char* pixels = image;
+
+  if (streaming) {
+
+    int band = y / band_rows;
+
+    if (bands[band] == NULL) {
+
+      bands[band] = (unsigned char*) malloc(width * band_rows * 4);
+
+      // write_bands frees them without the lock this is called under
+      int resident;
+
+      #pragma omp atomic capture
+      resident = ++resident_bands;
+
+      max_resident_bands = max(max_resident_bands, resident);
+
+    }
+
+    pixels = bands[band];
+    y -= band * band_rows;
+
+  }
   
-  image[4 * (y * width + x) + 0] = (unsigned char) round(color.x * 255);
-  image[4 * (y * width + x) + 1] = (unsigned char) round(color.y * 255);
-  image[4 * (y * width + x) + 2] = (unsigned char) round(color.z * 255);
-  image[4 * (y * width + x) + 3] = 255;
+  size_t p = (size_t) y * width + x;
+
+  pixels[4 * p + 0] = (unsigned char) round(color.x * 255);
+  pixels[4 * p + 1] = (unsigned char) round(color.y * 255);
+  pixels[4 * p + 2] = (unsigned char) round(color.z * 255);
+  pixels[4 * p + 3] = 255;
   
 }
 
+// Writes the mean of every pixel's samples so far
 void Film::write_to_image() {
+
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      set_pixel(x, y, get_color(x, y));
+    }
+  }
+
+  double start_time = omp_get_wtime();
   
-  unsigned error = lodepng_encode32_file(output, image, width, height);
+  unsigned error = PNGWriter::write(output, image, width, height, png_mode);
  
   if (error) {
     printf("Lodepng error: %u: %s\n", error, lodepng_error_text(error));
     exit(EXIT_FAILURE);
   }
+
+  printf("Encode time: %fs (%s)\n", omp_get_wtime() - start_time,
+      PNGWriter::mode_names[png_mode]);
+
+  if (hdr_format != HDRWriter::NONE) {
+    write_hdr();
+  }
   
 }
 
+// Writes the unclamped mean of every pixel's samples next to the PNG, with
+// the format's extension in place of .png
+void Film::write_hdr() {
+
+  string path = output;
+  size_t dot = path.rfind('.');
+
+  path = path.substr(0, dot) + "." + HDRWriter::format_names[hdr_format];
+
+  vector<float> means(3 * (size_t) width * height);
+
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+
+      size_t p = (size_t) y * width + x;
+      int count = max(sample_counts[p], 1);
+
+      means[3 * p + 0] = radiance[3 * p + 0] / count;
+      means[3 * p + 1] = radiance[3 * p + 1] / count;
+      means[3 * p + 2] = radiance[3 * p + 2] / count;
+
+    }
+  }
+
+  double start_time = omp_get_wtime();
+
+  if (!HDRWriter::write(path.c_str(), &means[0], width, height,
+      hdr_format)) {
+    printf("Could not write %s\n", path.c_str());
+    exit(EXIT_FAILURE);
+  }
+
+  printf("HDR time: %fs (%s)\n", omp_get_wtime() - start_time,
+      path.c_str());
+
+}
+
+// Opens the output for streaming, in bands of rows_per_band rows that are
+// each done once tiles_per_band tiles have finished in them
+void Film::begin_stream(int rows_per_band, int tiles_per_band) {
+
+  band_rows = rows_per_band;
+  next_band = 0;
+  ready_bands = 0;
+
+  int band_count = (height + band_rows - 1) / band_rows;
+  bands.assign(band_count, NULL);
+  tiles_left.assign(band_count, tiles_per_band);
+
+  // Only the quick encoder can write a band at a time
+  int mode = (png_mode == PNGWriter::BEST) ? PNGWriter::FAST : png_mode;
+
+  if (!stream.open(output, width, height, mode)) {
+    printf("Could not write %s\n", output);
+    exit(EXIT_FAILURE);
+  }
+
+  omp_init_lock(&stream_lock);
+
+}
+
+// Counts a finished tile in band, and marks every band that is done and has
+// nothing above it still to finish as ready to write. Called under the lock
+// tiles are added under, so it only does the counting.
+void Film::finish_tile(int band) {
+
+  tiles_left[band]--;
+
+  int ready = ready_bands;
+
+  while (ready < (int) bands.size() && tiles_left[ready] == 0) {
+    ready++;
+  }
+
+  #pragma omp atomic write seq_cst
+  ready_bands = ready;
+
+}
+
+// Compresses and writes every ready band, in order. Whichever thread gets
+// the stream lock writes them all, so the others never wait on the file;
+// it looks again after letting go, in case a band became ready meanwhile.
+void Film::write_bands() {
+
+  while (omp_test_lock(&stream_lock)) {
+
+    double start_time = omp_get_wtime();
+    int ready;
+
+    #pragma omp atomic read seq_cst
+    ready = ready_bands;
+
+    while (next_band < ready) {
+
+      int rows = min(band_rows, height - next_band * band_rows);
+
+      stream.write_rows(bands[next_band], rows);
+
+      free(bands[next_band]);
+      bands[next_band] = NULL;
+
+      #pragma omp atomic
+      resident_bands--;
+
+      next_band++;
+
+    }
+
+    encode_time += omp_get_wtime() - start_time;
+    int written = next_band;
+
+    omp_unset_lock(&stream_lock);
+
+    #pragma omp atomic read seq_cst
+    ready = ready_bands;
+
+    if (ready == written) {
+      break;
+    }
+
+  }
+
+}
+
+void Film::end_stream() {
+
+  write_bands();
+  omp_destroy_lock(&stream_lock);
+
+  if (!stream.close()) {
+    printf("Could not write %s\n", output);
+    exit(EXIT_FAILURE);
+  }
+
+  printf("Encode time: %fs (%s, streamed)\n", encode_time,
+      PNGWriter::mode_names[stream.mode]);
+  printf("Stream: %d bands of %d rows, at most %d in memory (%.1f MB)\n",
+      (int) bands.size(), band_rows, max_resident_bands,
+      max_resident_bands * width * band_rows * 4 / 1048576.0);
+
+}
+
 void Film::dispose() {
  
+  for (unsigned int b = 0; b < bands.size(); b++) {
+    free(bands[b]);
+  }
+
   if (width > 0 && height > 0) {
     free(image);
+    free(accumulation);
+    free(radiance);
+    free(sample_counts);
+    free(luminance_squares);
   }
   
 }
@@ -45,7 +366,41 @@ Film::Film(int image_width, int image_height) {
  
   width = image_width;
   height = image_height;
+
+  resident_bands = 0;
+  max_resident_bands = 0;
+  streamed_samples = 0;
+  encode_time = 0;
+
+  if (streaming) {
+    image = NULL;
+    accumulation = NULL;
+    radiance = NULL;
+    sample_counts = NULL;
+    luminance_squares = NULL;
+    return;
+  }
   
-  image = (unsigned char*) malloc(image_width * image_height * 4);
+  size_t pixels = (size_t) image_width * image_height;
+
+  image = (unsigned char*) malloc(pixels * 4);
+
+  accumulation = (float*) calloc(pixels * 3, sizeof(float));
+
+  // The PNG is made from clamped samples, and HDR output from these
+  if (hdr_format != HDRWriter::NONE) {
+    radiance = (float*) calloc(pixels * 3, sizeof(float));
+  } else {
+    radiance = NULL;
+  }
+
+  sample_counts = (int*) calloc(pixels, sizeof(int));
+
+  // Only adaptive sampling looks at the error of a pixel
+  if (Sampler::adaptive()) {
+    luminance_squares = (double*) calloc(pixels, sizeof(double));
+  } else {
+    luminance_squares = NULL;
+  }
   
-}
\ No newline at end of file
+}
@@ -0,0 +1,36 @@
+#include "hash.h"
+
+//*****************************************************************************
+// Hash
+//*****************************************************************************
+
+// Folds size bytes into hash
+unsigned long long Hash::bytes(unsigned long long hash, const void* data,
+    size_t size) {
+
+  const unsigned char* bytes = (const unsigned char*) data;
+
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+
+  return hash;
+
+}
+
+// Folds the rest of file into hash, and rewinds it for whoever reads it next
+unsigned long long Hash::file(unsigned long long hash, FILE* file) {
+
+  char buffer[65536];
+  size_t size;
+
+  while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    hash = bytes(hash, buffer, size);
+  }
+
+  rewind(file);
+
+  return hash;
+
+}
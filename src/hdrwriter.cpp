@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "hdrwriter.h"
+
+// OpenEXR's magic number, and version 2 with no flags (single part scanline)
+#define EXR_MAGIC 20000630
+#define EXR_VERSION 2
+
+// Pixel type of a half float channel
+#define EXR_HALF 1
+
+using namespace std;
+
+//*****************************************************************************
+// HDRWriter
+//*****************************************************************************
+
+const char* HDRWriter::format_names[3] = {"none", "pfm", "exr"};
+
+// The format called name, or -1
+int HDRWriter::parse_format(const char* name) {
+
+  for (int format = 0; format < 3; format++) {
+    if (strcmp(name, format_names[format]) == 0) {
+      return format;
+    }
+  }
+
+  return -1;
+
+}
+
+// Writes width x height RGB floats, top row first, in format. Returns false
+// if the file could not be written.
+bool HDRWriter::write(const char* path, const float* rgb, int width,
+    int height, int format) {
+
+  if (format == PFM) {
+    return write_pfm(path, rgb, width, height);
+  } else if (format == EXR) {
+    return write_exr(path, rgb, width, height);
+  }
+
+  return true;
+
+}
+
+// Portable float map. A negative scale marks the floats as little endian,
+// and the rows go from the bottom of the image up.
+bool HDRWriter::write_pfm(const char* path, const float* rgb, int width,
+    int height) {
+
+  FILE* file = fopen(path, "wb");
+
+  if (file == NULL) {
+    return false;
+  }
+
+  bool success = fprintf(file, "PF\n%d %d\n-1.0\n", width, height) > 0;
+
+  for (int y = height - 1; success && y >= 0; y--) {
+    success = fwrite(rgb + 3 * (size_t) y * width, sizeof(float), 3 * width,
+        file) == (size_t) 3 * width;
+  }
+
+  return (fclose(file) == 0) && success;
+
+}
+
+// Rounds to the nearest half float, ties to even, overflowing to infinity
+unsigned short HDRWriter::float_to_half(float value) {
+
+  unsigned int bits;
+  memcpy(&bits, &value, sizeof(bits));
+
+  unsigned int sign = (bits >> 16) & 0x8000;
+  unsigned int mantissa = bits & 0x7fffff;
+  int exponent = (int) ((bits >> 23) & 0xff) - 127 + 15;
+
+  // Infinity, or a quiet NaN
+  if ((bits & 0x7fffffff) >= 0x7f800000) {
+    return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+  }
+
+  if (exponent >= 31) {
+    return sign | 0x7c00;
+  }
+
+  // Subnormal, or too small to be anything but zero
+  if (exponent <= 0) {
+
+    if (exponent < -10) {
+      return sign;
+    }
+
+    mantissa |= 0x800000;
+
+    int shift = 14 - exponent;
+    unsigned int half = mantissa >> shift;
+    unsigned int remainder = mantissa & ((1u << shift) - 1);
+    unsigned int halfway = 1u << (shift - 1);
+
+    if (remainder > halfway || (remainder == halfway && (half & 1))) {
+      half++;
+    }
+
+    return sign | half;
+
+  }
+
+  unsigned int half = sign | (exponent << 10) | (mantissa >> 13);
+  unsigned int remainder = mantissa & 0x1fff;
+
+  // A carry out of the mantissa correctly bumps the exponent
+  if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) {
+    half++;
+  }
+
+  return half;
+
+}
+
+static void append_bytes(vector<unsigned char>& out, const void* data,
+    size_t size) {
+
+  const unsigned char* bytes = (const unsigned char*) data;
+  out.insert(out.end(), bytes, bytes + size);
+
+}
+
+// EXR is little endian throughout, like the machines this runs on
+static void append_int(vector<unsigned char>& out, int value) {
+
+  append_bytes(out, &value, sizeof(value));
+
+}
+
+static void append_attribute(vector<unsigned char>& out, const char* name,
+    const char* type, const vector<unsigned char>& value) {
+
+  append_bytes(out, name, strlen(name) + 1);
+  append_bytes(out, type, strlen(type) + 1);
+  append_int(out, value.size());
+  out.insert(out.end(), value.begin(), value.end());
+
+}
+
+// One scanline per block, uncompressed, with the channels in the
+// alphabetical order EXR stores them in
+bool HDRWriter::write_exr(const char* path, const float* rgb, int width,
+    int height) {
+
+  vector<unsigned char> header;
+  vector<unsigned char> value;
+
+  append_int(header, EXR_MAGIC);
+  append_int(header, EXR_VERSION);
+
+  const char* channels[3] = {"B", "G", "R"};
+
+  for (int c = 0; c < 3; c++) {
+
+    append_bytes(value, channels[c], 2);
+    append_int(value, EXR_HALF);
+
+    // Perceptually linear flag, reserved bytes, then x and y sampling
+    const unsigned char flags[4] = {0, 0, 0, 0};
+    append_bytes(value, flags, 4);
+    append_int(value, 1);
+    append_int(value, 1);
+
+  }
+
+  value.push_back(0);
+  append_attribute(header, "channels", "chlist", value);
+
+  value.assign(1, 0);
+  append_attribute(header, "compression", "compression", value);
+
+  int window[4] = {0, 0, width - 1, height - 1};
+  value.clear();
+  append_bytes(value, window, sizeof(window));
+  append_attribute(header, "dataWindow", "box2i", value);
+  append_attribute(header, "displayWindow", "box2i", value);
+
+  // Increasing y
+  value.assign(1, 0);
+  append_attribute(header, "lineOrder", "lineOrder", value);
+
+  float aspect = 1;
+  value.clear();
+  append_bytes(value, &aspect, sizeof(aspect));
+  append_attribute(header, "pixelAspectRatio", "float", value);
+
+  float center[2] = {0, 0};
+  value.clear();
+  append_bytes(value, center, sizeof(center));
+  append_attribute(header, "screenWindowCenter", "v2f", value);
+
+  float window_width = 1;
+  value.clear();
+  append_bytes(value, &window_width, sizeof(window_width));
+  append_attribute(header, "screenWindowWidth", "float", value);
+
+  header.push_back(0);
+
+  // Where each scanline block starts, after the header and this table
+  int line_size = 3 * 2 * width;
+  unsigned long long offset = header.size() + 8 * (unsigned long long) height;
+
+  for (int y = 0; y < height; y++) {
+    append_bytes(header, &offset, sizeof(offset));
+    offset += 8 + line_size;
+  }
+
+  FILE* file = fopen(path, "wb");
+
+  if (file == NULL) {
+    return false;
+  }
+
+  bool success = fwrite(&header[0], 1, header.size(), file) == header.size();
+
+  vector<unsigned char> line;
+  vector<unsigned short> halves(width);
+
+  for (int y = 0; success && y < height; y++) {
+
+    line.clear();
+    append_int(line, y);
+    append_int(line, line_size);
+
+    // B, G, then R, each for the whole row
+    for (int c = 2; c >= 0; c--) {
+
+      for (int x = 0; x < width; x++) {
+        halves[x] = float_to_half(rgb[3 * ((size_t) y * width + x) + c]);
+      }
+
+      append_bytes(line, &halves[0], 2 * width);
+
+    }
+
+    success = fwrite(&line[0], 1, line.size(), file) == line.size();
+
+  }
+
+  return (fclose(file) == 0) && success;
+
+}
@@ -0,0 +1,20 @@
+#include "hitrecord.h"
+
+//*****************************************************************************
+// HitRecord
+//*****************************************************************************
+
+HitRecord::HitRecord() {
+
+  shape = NULL;
+  index = 0;
+  t = 0;
+  beta = 0;
+  gamma = 0;
+  point = Vector(0, 0, 0);
+  normal = Vector(0, 0, 0);
+  shading_normal = Vector(0, 0, 0);
+  u = 0;
+  v = 0;
+
+}
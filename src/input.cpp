@@ -61,7 +61,7 @@ void InputUtils::parse_camera_input(Scene* scene, char* input,
 }
 
 void InputUtils::parse_sphere_input(Scene* scene, char* input, 
-    Matrix transform_matrix, Material material, int linecount) {
+    Matrix transform_matrix, const Material& material, int linecount) {
   
   // Declarations
 
@@ -79,8 +79,8 @@ void InputUtils::parse_sphere_input(Scene* scene, char* input,
 
   sphere->center = Vector(output[0], output[1], output[2]);
   sphere->radius = output[3]; 
-  sphere->transform = Matrix::inverse(transform_matrix);
-  sphere->material = material;
+  sphere->set_transform(Matrix::inverse(transform_matrix));
+  sphere->material = scene->add_material(material);
   sphere->compute_bounding_box();
 
   scene->add_surface(sphere);
@@ -88,7 +88,7 @@ void InputUtils::parse_sphere_input(Scene* scene, char* input,
 }
 
 void InputUtils::parse_triangle_input(Scene* scene, char* input, 
-    Matrix transform_matrix, Material material, int linecount) {
+    Matrix transform_matrix, const Material& material, int linecount) {
   
   // Declarations
   float output[9];
@@ -115,10 +115,11 @@ void InputUtils::parse_triangle_input(Scene* scene, char* input,
   Vector V = point3 - point1;
   Vector normal = Vector::cross(U, V);
   Vector view = (point1 + point2 + point3) / 3 - scene->camera.origin;
+  unsigned short material_index = scene->add_material(material);
   if (Vector::dot(normal, view) > 0) {
-    triangle = new Triangle(Matrix::identity_matrix(), point1, point3, point2, -1*normal, material);
+    triangle = new Triangle(Matrix::identity_matrix(), point1, point3, point2, -1*normal, material_index);
   } else {
-    triangle = new Triangle(Matrix::identity_matrix(), point1, point2, point3, normal, material);
+    triangle = new Triangle(Matrix::identity_matrix(), point1, point2, point3, normal, material_index);
   }
 
   scene->add_surface(triangle);
@@ -126,12 +127,12 @@ void InputUtils::parse_triangle_input(Scene* scene, char* input,
 }
 
 void InputUtils::parse_obj_input(Scene* scene, char* input,
-    Matrix transform_matrix, Material material, int linecount) {
+    Matrix transform_matrix, const Material& material, int linecount) {
 
   // Strip the header
   input = strtok(NULL, " \n\t\r");
 
-  // Load the obj file
+  // Check the obj file exists
   FILE* file = NULL;
   if (input) {
     file = fopen(input, "r"); 
@@ -147,12 +148,57 @@ void InputUtils::parse_obj_input(Scene* scene, char* input,
     return;
   }
 
+  fclose(file);
+
+  // The faces are read by load_meshes, once the tree settings are known
+  TriangleMesh* mesh = new TriangleMesh(transform_matrix, 
+      scene->add_material(material));
+  mesh->source = input;
+  mesh->view_origin = scene->camera.origin;
+
   // Check for extra parameters
   input = strtok(NULL, " \n\t\r");
   if (input)
     cerr << "Line " << linecount << " has extra parameters, which were ignored." << endl;
 
-  cout << "Now parsing .obj file: " << input << endl;
+  scene->add_mesh(mesh);
+  
+}
+
+// Reads the faces of every mesh, and builds each one's tree, unless its
+// cache already holds both
+void InputUtils::load_meshes(Scene* scene) {
+
+  for (unsigned int i = 0; i < scene->meshes.size(); i++) {
+    load_mesh(scene, scene->meshes[i]);
+  }
+
+}
+
+void InputUtils::load_mesh(Scene* scene, TriangleMesh* mesh) {
+
+  FILE* file = fopen(mesh->source.c_str(), "r");
+
+  if (file == NULL) {
+    cerr << "Error: Could not read .obj file " << mesh->source << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  // A checkpoint has to be resumed with the same meshes
+  unsigned long long contents = Hash::file(HASH_SEED, file);
+  scene->identity = Hash::bytes(scene->identity, &contents, 
+      sizeof(contents));
+
+  string cache = mesh->source + ".bvh";
+  unsigned long long key = BVHCache::key(contents, mesh->transform);
+
+  if (BVHCache::enabled && BVHCache::load(mesh, cache, key)) {
+    fclose(file);
+    cout << "BVH cache: loaded " << cache << endl;
+    return;
+  }
+
+  cout << "Now parsing .obj file: " << mesh->source << endl;
 
   // Declarations
   int success;
@@ -160,17 +206,14 @@ void InputUtils::parse_obj_input(Scene* scene, char* input,
   char line[256];
   char *tokenised_line;
   float output[9] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
-  vector<Vector> vertices;
-  vector<Vector> vnormals;
-  vector<Vector> texture_coords;
 
   // Create offset and provide "nonexistent" coordinate
-  vertices.push_back(Vector(0, 0, 0));
-  vnormals.push_back(Vector(0, 0, 0));
-  texture_coords.push_back(Vector(0, 0, 0));
+  mesh->add_vertex(Vector(0, 0, 0));
+  mesh->add_normal(Vector(0, 0, 0));
+  mesh->add_tcoord(Vector(0, 0, 0));
 
   while (fgets(line, sizeof(line), file)) {
-    
+
     // Tokenise the line, and get rid of header
     tokenised_line = strtok(line, " \n\t\r");
     
@@ -187,7 +230,7 @@ void InputUtils::parse_obj_input(Scene* scene, char* input,
         cerr << "Line " << objlinecount << " has extra parameters, which were ignored." << endl;
       }
       Vector vertex = Vector(output[0], output[1], output[2]);
-      vertices.push_back(vertex);
+      mesh->add_vertex(vertex);
     
     } else if (strcmp(tokenised_line, "vn") == 0) {
       
@@ -200,7 +243,7 @@ void InputUtils::parse_obj_input(Scene* scene, char* input,
         cerr << "Line " << objlinecount << " has extra parameters, which were ignored." << endl;
       }
       Vector normal = Vector(output[0], output[1], output[2]);
-      vnormals.push_back(normal);
+      mesh->add_normal(normal);
     
     } else if (strcmp(tokenised_line, "f") == 0) {
 
@@ -219,50 +262,13 @@ void InputUtils::parse_obj_input(Scene* scene, char* input,
         cerr << "Line " << objlinecount << " has extra parameters, which were ignored." << endl;
       }
 
-      Triangle* triangle;
-      
-      try {
-
-        Vector point1 = vertices.at(vertnum[0]);
-        Vector point2 = vertices.at(vertnum[1]);
-        Vector point3 = vertices.at(vertnum[2]);
-        Vector coord1 = texture_coords.at(tcoordnum[0]);
-        Vector coord2 = texture_coords.at(tcoordnum[1]);
-        Vector coord3 = texture_coords.at(tcoordnum[2]);
-
-        if (vnormnum[0] == 0 && vnormnum[1] == 0 && vnormnum[2] == 0) {
-          // Check direction of normal in relation to camera
-          point1 = Matrix::transform(transform_matrix, point1);
-          point2 = Matrix::transform(transform_matrix, point2);
-          point3 = Matrix::transform(transform_matrix, point3);
-          Vector U = point2 - point1;
-          Vector V = point3 - point1;
-          Vector normal = Vector::cross(U, V);
-          Vector view = (point1 + point2 + point3) / 3 - scene->camera.origin;
-          if (Vector::dot(normal, view) > 0) {
-            triangle = new Triangle(Matrix::identity_matrix(), point1, point3, point2, -1*normal, material);
-          } else {
-            triangle = new Triangle(Matrix::identity_matrix(), point1, point2, point3, normal, material);
-          }
-          triangle->tcoord1 = coord1;
-          triangle->tcoord2 = coord2;
-          triangle->tcoord3 = coord3;
-        } else {
-          Vector norm1 = vnormals.at(vnormnum[0]);
-          Vector norm2 = vnormals.at(vnormnum[1]);
-          Vector norm3 = vnormals.at(vnormnum[2]);
-          triangle = new Triangle(transform_matrix, point1, point2, point3,
-              norm1, norm2, norm3, coord1, coord2, coord3, material);
-        }
-
-      } catch (const std::out_of_range& e) {
+      if (!mesh->add_face(vertnum, vnormnum, tcoordnum, 
+          mesh->view_origin)) {
         cerr << "Line " << objlinecount << " does not contain valid parameters. Line ignored." << endl;
         objlinecount++;
         continue;
       }
 
-      scene->add_surface(triangle);
-
     } else if (strcmp(tokenised_line, "vt") == 0) {
       
       success = parse_float_input(tokenised_line, output, 3, objlinecount);
@@ -274,7 +280,7 @@ void InputUtils::parse_obj_input(Scene* scene, char* input,
         cerr << "Line " << objlinecount << " has extra parameters, which were ignored." << endl;
       }
       Vector tcoord = Vector(output[0], output[1], 1);
-      texture_coords.push_back(tcoord);
+      mesh->add_tcoord(tcoord);
     
     } else if (tokenised_line[0] == '#') {
       objlinecount++;
@@ -292,6 +298,20 @@ void InputUtils::parse_obj_input(Scene* scene, char* input,
   fclose(file);
 
   cout << "Finished parsing .obj file." << endl;
+
+  double start_time = omp_get_wtime();
+  mesh->tree = BoundingTree::build_mesh(mesh);
+  printf("Mesh build time: %fs\n", omp_get_wtime() - start_time);
+
+  if (!BVHCache::enabled || mesh->face_count() == 0) {
+    return;
+  }
+
+  if (BVHCache::save(mesh, cache, key)) {
+    cout << "BVH cache: wrote " << cache << endl;
+  } else {
+    cerr << "BVH cache: could not write " << cache << endl;
+  }
   
 }
 
@@ -520,20 +540,62 @@ void InputUtils::parse_idt_transform_input(char* input, Matrix* transform_matrix
   
 }
 
+int InputUtils::parse_sampler_strategy(char* name) {
+
+  if (strcmp(name, "jitter") == 0) {
+    return Sampler::JITTER;
+  } else if (strcmp(name, "sobol") == 0) {
+    return Sampler::SOBOL;
+  } else if (strcmp(name, "halton") == 0) {
+    return Sampler::HALTON;
+  } else if (strcmp(name, "bluenoise") == 0) {
+    return Sampler::BLUE_NOISE;
+  }
+
+  return -1;
+
+}
+
+// als n <strategy> takes n samples per pixel, placed by any of the
+// strategies. The older als n, without one, still means an n x n jittered
+// grid, so it is read as als n*n jitter.
 void InputUtils::parse_antialias_input(char* input, int linecount) {
 
-  float output[1];
-  
-  int success = parse_float_input(input, output, 1, linecount);
-  // Can only support exactly 1 inputs
-  if (success < 0) {
+  // Strip the header
+  input = strtok(NULL, " \n\t\r");
+
+  if (input == NULL) {
     cerr << "Line " << linecount << " does not contain enough parameters, and was ignored." << endl;
     return;
-  } else if (success > 0) {
-    cerr << "Line " << linecount << " has extra parameters, which were ignored." << endl;
   }
 
-  Sampler::samples = (int) output[0];
+  if (!isdigit(input[0]) || atoi(input) < 1) {
+    cerr << "Line " << linecount << " was not formatted correctly, and was ignored." << endl;
+    return;
+  }
+
+  int count = atoi(input);
+  input = strtok(NULL, " \n\t\r");
+
+  if (input == NULL) {
+    Sampler::samples = count * count;
+    Sampler::strategy = Sampler::JITTER;
+    return;
+  }
+
+  int strategy = parse_sampler_strategy(input);
+
+  if (strategy < 0) {
+    cerr << "Line " << linecount << " was not formatted correctly, and was ignored." << endl;
+    return;
+  }
+
+  Sampler::samples = count;
+  Sampler::strategy = strategy;
+
+  if (strtok(NULL, " \n\t\r") != NULL) {
+    cerr << "Line " << linecount << " has extra parameters, which were ignored." << endl;
+  }
 
 }
 
@@ -555,3 +617,68 @@ void InputUtils::parse_refract_input(Material* material, char* input, int lineco
   }
   
 }
+
+int InputUtils::parse_bvh_method(char* name) {
+
+  if (strcmp(name, "sah") == 0) {
+    return BoundingTree::SAH;
+  } else if (strcmp(name, "median") == 0) {
+    return BoundingTree::MEDIAN;
+  }
+
+  return -1;
+
+}
+
+bool InputUtils::valid_bvh_width(int width) {
+
+  return width == 2 || width == 4 || width == 8;
+
+}
+
+void InputUtils::parse_bvh_input(char* input, int linecount) {
+
+  // Strip the header
+  input = strtok(NULL, " \n\t\r");
+
+  if (input == NULL) {
+    cerr << "Line " << linecount << " does not contain enough parameters, and was ignored." << endl;
+    return;
+  }
+
+  int method = parse_bvh_method(input);
+
+  if (method < 0) {
+    cerr << "Line " << linecount << " was not formatted correctly, and was ignored." << endl;
+    return;
+  }
+
+  BoundingTree::method = method;
+
+  // Optional maximum number of shapes per leaf
+  input = strtok(NULL, " \n\t\r");
+
+  if (input != NULL) {
+    if (!isdigit(input[0]) || atoi(input) < 1) {
+      cerr << "Line " << linecount << " was not formatted correctly, and was ignored." << endl;
+      return;
+    }
+    BoundingTree::leaf_size = min(atoi(input), BVH_MAX_LEAF_SIZE);
+    input = strtok(NULL, " \n\t\r");
+  }
+
+  // Optional tree width
+  if (input != NULL) {
+    if (!isdigit(input[0]) || !valid_bvh_width(atoi(input))) {
+      cerr << "Line " << linecount << " was not formatted correctly, and was ignored." << endl;
+      return;
+    }
+    BoundingTree::width = atoi(input);
+    input = strtok(NULL, " \n\t\r");
+  }
+
+  if (input != NULL) {
+    cerr << "Line " << linecount << " has extra parameters, which were ignored." << endl;
+  }
+
+}
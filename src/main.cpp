@@ -44,6 +44,10 @@
 #include "scene.h"
 #endif
 
+#ifndef PNGWRITER_H
+#include "pngwriter.h"
+#endif
+
 #ifndef INPUT_H
 #include "input.h"
 #endif
@@ -52,6 +56,14 @@
 #include "raytracer.h"
 #endif
 
+#ifndef HASH_H
+#include "hash.h"
+#endif
+
+#ifndef BVHCACHE_H
+#include "bvhcache.h"
+#endif
+
 using namespace std;
 
 //****************************************************
@@ -63,8 +75,29 @@ int image_height = 1000;
 
 int Raytracer::max_depth = 3;
 
-// Samples n x n points
-int Sampler::samples = 1; 
+// Samples per pixel, and how they are placed
+int Sampler::samples = 1;
+int Sampler::strategy = Sampler::JITTER;
+int Sampler::max_samples = 0;
+float Sampler::max_error = 0.0025;
+
+// Bounding tree construction
+int BoundingTree::method = BoundingTree::SAH;
+int BoundingTree::leaf_size = 4;
+int BoundingTree::width = 2;
+bool BVHCache::enabled = true;
+
+// Render scheduling
+int Scene::passes = 1;
+int Scene::checkpoint_interval = 0;
+bool Scene::resume = false;
+
+// Image output
+int Film::png_mode = PNGWriter::BEST;
+int Film::hdr_format = HDRWriter::NONE;
+bool Film::streaming = false;
+int TileScheduler::tile_size = 16;
+int TileScheduler::threads = 0;
 
 char output_filename[] = "output-00.png";
 
@@ -96,9 +129,13 @@ void parse_input(char* input) {
   
   Matrix transform_matrix = Matrix::identity_matrix(); 
   Material material;
+
+  scene.identity = HASH_SEED;
   
   // Print out each line
   while (fgets(line, sizeof(line), file)) {
+
+    scene.identity = Hash::bytes(scene.identity, line, strlen(line));
     
     // Tokenise the line, starting at header
     tokenised_line = strtok(line, " \n\t\r");
@@ -143,6 +180,8 @@ void parse_input(char* input) {
       InputUtils::parse_antialias_input(tokenised_line, linecount);
     } else if (strcmp(tokenised_line, "rfc") == 0) {
       InputUtils::parse_refract_input(&material, tokenised_line, linecount);
+    } else if (strcmp(tokenised_line, "bvh") == 0) {
+      InputUtils::parse_bvh_input(tokenised_line, linecount);
     } else {
         cerr << "Command \"" << tokenised_line << "\" unrecognized. Line " <<
             linecount << " ignored." << endl;
@@ -157,10 +196,160 @@ void parse_input(char* input) {
   
 }
 
+//****************************************************
+// Command Line Options
+//****************************************************
+
+// Options given after the input file override those in the input file
+void parse_options(int argc, char *argv[]) {
+
+  for (int i = 2; i < argc; i++) {
+
+    if (strcmp(argv[i], "--bvh") == 0 && i + 1 < argc) {
+
+      int method = InputUtils::parse_bvh_method(argv[++i]);
+
+      if (method < 0) {
+        cerr << "Error: Unknown bvh method " << argv[i] << endl;
+        exit(EXIT_FAILURE);
+      }
+
+      BoundingTree::method = method;
+
+    } else if (strcmp(argv[i], "--bvh-width") == 0 && i + 1 < argc) {
+
+      BoundingTree::width = atoi(argv[++i]);
+
+      if (!InputUtils::valid_bvh_width(BoundingTree::width)) {
+        cerr << "Error: Tree width must be 2, 4 or 8" << endl;
+        exit(EXIT_FAILURE);
+      }
+
+    } else if (strcmp(argv[i], "--leaf-size") == 0 && i + 1 < argc) {
+
+      BoundingTree::leaf_size = atoi(argv[++i]);
+
+      if (BoundingTree::leaf_size < 1) {
+        cerr << "Error: Leaf size must be at least 1" << endl;
+        exit(EXIT_FAILURE);
+      }
+
+      BoundingTree::leaf_size = min(BoundingTree::leaf_size, 
+          BVH_MAX_LEAF_SIZE);
+
+    } else if (strcmp(argv[i], "--no-bvh-cache") == 0) {
+
+      BVHCache::enabled = false;
+
+    } else if (strcmp(argv[i], "--tile-size") == 0 && i + 1 < argc) {
+
+      TileScheduler::tile_size = atoi(argv[++i]);
+
+      if (TileScheduler::tile_size < 1) {
+        cerr << "Error: Tile size must be at least 1" << endl;
+        exit(EXIT_FAILURE);
+      }
+
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+
+      TileScheduler::threads = atoi(argv[++i]);
+
+      if (TileScheduler::threads < 1) {
+        cerr << "Error: Thread count must be at least 1" << endl;
+        exit(EXIT_FAILURE);
+      }
+
+    } else if (strcmp(argv[i], "--passes") == 0 && i + 1 < argc) {
+
+      Scene::passes = atoi(argv[++i]);
+
+      if (Scene::passes < 1) {
+        cerr << "Error: Pass count must be at least 1" << endl;
+        exit(EXIT_FAILURE);
+      }
+
+    } else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+
+      Scene::checkpoint_interval = atoi(argv[++i]);
+
+      if (Scene::checkpoint_interval < 1) {
+        cerr << "Error: Checkpoint interval must be at least 1 second" << endl;
+        exit(EXIT_FAILURE);
+      }
+
+    } else if (strcmp(argv[i], "--resume") == 0) {
+
+      Scene::resume = true;
+
+    } else if (strcmp(argv[i], "--png") == 0 && i + 1 < argc) {
+
+      Film::png_mode = PNGWriter::parse_mode(argv[++i]);
+
+      if (Film::png_mode < 0) {
+        cerr << "Error: PNG mode must be best, fast or stored" << endl;
+        exit(EXIT_FAILURE);
+      }
+
+    } else if (strcmp(argv[i], "--hdr") == 0 && i + 1 < argc) {
+
+      Film::hdr_format = HDRWriter::parse_format(argv[++i]);
+
+      if (Film::hdr_format < 0) {
+        cerr << "Error: HDR format must be pfm, exr or none" << endl;
+        exit(EXIT_FAILURE);
+      }
+
+    } else if (strcmp(argv[i], "--stream") == 0) {
+
+      Film::streaming = true;
+
+    } else if (strcmp(argv[i], "--adaptive") == 0 && i + 1 < argc) {
+
+      Sampler::max_samples = atoi(argv[++i]);
+
+      if (Sampler::max_samples < MIN_ADAPTIVE_SAMPLES) {
+        cerr << "Error: Adaptive sample cap must be at least "
+            << MIN_ADAPTIVE_SAMPLES << endl;
+        exit(EXIT_FAILURE);
+      }
+
+    } else if (strcmp(argv[i], "--adaptive-error") == 0 && i + 1 < argc) {
+
+      Sampler::max_error = atof(argv[++i]);
+
+      if (Sampler::max_error <= 0) {
+        cerr << "Error: Adaptive error threshold must be positive" << endl;
+        exit(EXIT_FAILURE);
+      }
+
+    } else {
+      cerr << "Error: Incorrect input" << endl;
+      exit(EXIT_FAILURE);
+    }
+
+  }
+
+  // A streamed pixel is gone once written, so it can never be revisited
+  if (Film::streaming && (Scene::passes > 1 || Scene::checkpoint_interval > 0 ||
+      Scene::resume)) {
+    cerr << "Error: --stream renders in a single pass, without checkpoints"
+        << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  if (Film::streaming && Film::hdr_format != HDRWriter::NONE) {
+    cerr << "Error: --hdr needs the whole film, so cannot be streamed" << endl;
+    exit(EXIT_FAILURE);
+  }
+
+}
+
 int main(int argc, char *argv[]) {
   
-  if (argc == 2) {
+  if (argc >= 2) {
     parse_input(argv[1]);
+    parse_options(argc, argv);
+    InputUtils::load_meshes(&scene);
   } else {
     cerr << "Error: Incorrect input" << endl;
     exit(EXIT_FAILURE);
@@ -169,9 +358,14 @@ int main(int argc, char *argv[]) {
   // Film is the class that writes to the image
   scene.film = Film(image_width, image_height);
   scene.film.output = output_filename;
+  scene.checkpoint = string(output_filename) + ".ckpt";
+
+  // Only HDR renders keep the unclamped sums a checkpoint would have to hold
+  bool hdr = (Film::hdr_format != HDRWriter::NONE);
+  scene.identity = Hash::bytes(scene.identity, &hdr, sizeof(hdr));
   
   // Intersection acceleration
-  scene.bbox_tree = new BoundingTree(scene.surfaces, NULL, 0, true);
+  scene.bbox_tree = BoundingTree::build(scene.surfaces, scene.meshes);
 
   // Main Loop
   scene.render();
@@ -8,6 +8,9 @@ using namespace std;
 // Material
 //****************************************************
 
+const float Material::glassIndex = 1.52;
+const float Material::airIndex = 1.0;
+
 Material::Material() {
   
   ambient = Vector(0, 0, 0);
@@ -30,7 +33,22 @@ Material::Material(Vector ka, Vector kd, Vector ks, Vector kr, float pe, bool re
   
 }
 
-Vector Material::diffuse_c(Vector color, Vector light, Vector normal) {
+// Whether two materials shade identically, so the scene can share one entry
+bool Material::equals(const Material& other) const {
+
+  return ambient.x == other.ambient.x && ambient.y == other.ambient.y &&
+      ambient.z == other.ambient.z && diffuse.x == other.diffuse.x &&
+      diffuse.y == other.diffuse.y && diffuse.z == other.diffuse.z &&
+      specular.x == other.specular.x && specular.y == other.specular.y &&
+      specular.z == other.specular.z && reflective.x == other.reflective.x &&
+      reflective.y == other.reflective.y && 
+      reflective.z == other.reflective.z && refract == other.refract &&
+      phong_e == other.phong_e;
+
+}
+
+Vector Material::diffuse_c(const Vector& color, const Vector& light, 
+    const Vector& normal) const {
 
   float similarity = Vector::dot(light, normal) / (light.len() * normal.len());
 
@@ -44,14 +62,14 @@ Vector Material::diffuse_c(Vector color, Vector light, Vector normal) {
 
 }
 
-Vector Material::ambient_c(Vector color) {
+Vector Material::ambient_c(const Vector& color) const {
 
   return Vector::point_multiply(ambient, color);
 
 }
 
-Vector Material::specular_c(Vector color, Vector light, Vector viewer, 
-    Vector normal) {
+Vector Material::specular_c(const Vector& color, const Vector& light, 
+    const Vector& viewer, const Vector& normal) const {
 
   float dbl = 2.0 * Vector::dot(light, normal); 
   Vector r = dbl * normal;
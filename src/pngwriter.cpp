@@ -0,0 +1,495 @@
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <omp.h>
+
+#include "pngwriter.h"
+#include "lodepng.h"
+
+using namespace std;
+
+// Largest prime below 2^16, the modulus of the Adler-32 checksum
+#define ADLER_BASE 65521
+
+// Positions remembered by the match finder, one per hash of three bytes
+#define HASH_BITS 15
+#define WINDOW_SIZE 32768
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+
+//*****************************************************************************
+// Checksums
+//*****************************************************************************
+
+static unsigned int adler32(const unsigned char* data, size_t size) {
+
+  unsigned int s1 = 1;
+  unsigned int s2 = 0;
+
+  while (size > 0) {
+
+    // Largest run that cannot overflow s2 before reducing
+    size_t run = (size < 5552) ? size : 5552;
+    size -= run;
+
+    for (size_t i = 0; i < run; i++) {
+      s1 += data[i];
+      s2 += s1;
+    }
+
+    data += run;
+    s1 %= ADLER_BASE;
+    s2 %= ADLER_BASE;
+
+  }
+
+  return (s2 << 16) | s1;
+
+}
+
+// Checksum of a followed by b, from their separate checksums and the length
+// of b, as zlib's adler32_combine
+static unsigned int adler32_combine(unsigned int a, unsigned int b,
+    size_t b_size) {
+
+  unsigned int remainder = b_size % ADLER_BASE;
+  unsigned int s1 = a & 0xffff;
+  unsigned int s2 = (unsigned int) (((unsigned long long) remainder * s1) %
+      ADLER_BASE);
+
+  s1 += (b & 0xffff) + ADLER_BASE - 1;
+  s2 += ((a >> 16) & 0xffff) + ((b >> 16) & 0xffff) + ADLER_BASE - remainder;
+
+  if (s1 >= ADLER_BASE) s1 -= ADLER_BASE;
+  if (s1 >= ADLER_BASE) s1 -= ADLER_BASE;
+  if (s2 >= 2 * ADLER_BASE) s2 -= 2 * ADLER_BASE;
+  if (s2 >= ADLER_BASE) s2 -= ADLER_BASE;
+
+  return (s2 << 16) | s1;
+
+}
+
+//*****************************************************************************
+// Deflate
+//*****************************************************************************
+
+// Smallest length and distance of each deflate code, and their extra bits
+static const int length_base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17,
+    19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const int length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2,
+    2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const int distance_base[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33,
+    49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097,
+    6145, 8193, 12289, 16385, 24577};
+static const int distance_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4,
+    5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+static int find_code(const int* base, int count, int value) {
+
+  int code = 0;
+
+  while (code + 1 < count && base[code + 1] <= value) {
+    code++;
+  }
+
+  return code;
+
+}
+
+// Writes bits to a byte vector, least significant first, as deflate wants
+class BitWriter {
+
+  public:
+
+    vector<unsigned char>* out;
+    unsigned long long buffer;
+    int count;
+
+    BitWriter(vector<unsigned char>* output) {
+      out = output;
+      buffer = 0;
+      count = 0;
+    }
+
+    void write(unsigned int bits, int length) {
+
+      buffer |= (unsigned long long) bits << count;
+      count += length;
+
+      while (count >= 8) {
+        out->push_back(buffer & 0xff);
+        buffer >>= 8;
+        count -= 8;
+      }
+
+    }
+
+    // Huffman codes are defined most significant bit first
+    void write_code(unsigned int code, int length) {
+
+      unsigned int reversed = 0;
+
+      for (int i = 0; i < length; i++) {
+        reversed |= ((code >> i) & 1) << (length - 1 - i);
+      }
+
+      write(reversed, length);
+
+    }
+
+    // Pads with an empty stored block, so the stream ends on a byte
+    void flush() {
+
+      write(0, 3);
+
+      if (count > 0) {
+        write(0, 8 - count);
+      }
+
+      write(0x0000, 16);
+      write(0xffff, 16);
+
+    }
+
+};
+
+// The fixed Huffman code of a literal or length symbol
+static void write_symbol(BitWriter* bits, int symbol) {
+
+  if (symbol < 144) {
+    bits->write_code(0x30 + symbol, 8);
+  } else if (symbol < 256) {
+    bits->write_code(0x190 + symbol - 144, 9);
+  } else if (symbol < 280) {
+    bits->write_code(symbol - 256, 7);
+  } else {
+    bits->write_code(0xc0 + symbol - 280, 8);
+  }
+
+}
+
+static void write_match(BitWriter* bits, int length, int distance) {
+
+  int code = find_code(length_base, 29, length);
+  write_symbol(bits, 257 + code);
+  bits->write(length - length_base[code], length_extra[code]);
+
+  code = find_code(distance_base, 30, distance);
+  bits->write_code(code, 5);
+  bits->write(distance - distance_base[code], distance_extra[code]);
+
+}
+
+// One fixed Huffman block over data, taking the longest match at the last
+// position with the same three bytes, or a literal
+static void deflate_fast(const unsigned char* data, int size, BitWriter* bits,
+    vector<int>& head) {
+
+  head.assign(1 << HASH_BITS, -1);
+
+  // Not the last block, fixed Huffman codes
+  bits->write(0, 1);
+  bits->write(1, 2);
+
+  int pos = 0;
+
+  while (pos < size) {
+
+    if (pos + MIN_MATCH <= size) {
+
+      unsigned int hash = (data[pos] | data[pos + 1] << 8 |
+          data[pos + 2] << 16) * 2654435761u >> (32 - HASH_BITS);
+      int candidate = head[hash];
+      head[hash] = pos;
+
+      if (candidate >= 0 && pos - candidate <= WINDOW_SIZE) {
+
+        int limit = min(MAX_MATCH, size - pos);
+        int length = 0;
+
+        while (length < limit && data[candidate + length] == data[pos + length]) {
+          length++;
+        }
+
+        if (length >= MIN_MATCH) {
+          write_match(bits, length, pos - candidate);
+          pos += length;
+          continue;
+        }
+
+      }
+
+    }
+
+    write_symbol(bits, data[pos++]);
+
+  }
+
+  // End of block
+  write_symbol(bits, 256);
+
+}
+
+// Stored blocks of at most 65535 bytes. The stream is always on a byte
+// boundary here, so each header takes one byte.
+static void deflate_stored(const unsigned char* data, int size,
+    vector<unsigned char>* out) {
+
+  for (int pos = 0; pos < size; pos += 65535) {
+
+    int length = min(65535, size - pos);
+
+    out->push_back(0);
+    out->push_back(length & 0xff);
+    out->push_back(length >> 8);
+    out->push_back(~length & 0xff);
+    out->push_back((~length >> 8) & 0xff);
+    out->insert(out->end(), data + pos, data + pos + length);
+
+  }
+
+}
+
+//*****************************************************************************
+// PNGWriter
+//*****************************************************************************
+
+const char* PNGWriter::mode_names[3] = {"stored", "fast", "best"};
+
+// The mode called name, or -1
+int PNGWriter::parse_mode(const char* name) {
+
+  for (int mode = 0; mode < 3; mode++) {
+    if (strcmp(name, mode_names[mode]) == 0) {
+      return mode;
+    }
+  }
+
+  return -1;
+
+}
+
+static void append_uint(vector<unsigned char>& out, unsigned int value) {
+
+  out.push_back(value >> 24);
+  out.push_back(value >> 16);
+  out.push_back(value >> 8);
+  out.push_back(value);
+
+}
+
+// Starts a chunk: room for the length, then the type
+static void begin_chunk(vector<unsigned char>& chunk, const char* type) {
+
+  chunk.clear();
+  append_uint(chunk, 0);
+  chunk.insert(chunk.end(), type, type + 4);
+
+}
+
+// Fills in the length, and appends the CRC of the type and data
+static void end_chunk(vector<unsigned char>& chunk) {
+
+  unsigned int length = chunk.size() - 8;
+
+  chunk[0] = length >> 24;
+  chunk[1] = length >> 16;
+  chunk[2] = length >> 8;
+  chunk[3] = length;
+
+  append_uint(chunk, lodepng_crc32(&chunk[4], length + 4));
+
+}
+
+// Builds the IDAT chunk for rows [first_row, end_row), and the Adler-32
+// checksum of the filtered rows it compressed
+void PNGWriter::compress_band(const unsigned char* rgba, int width,
+    int first_row, int end_row, int mode, vector<unsigned char>& chunk,
+    unsigned int* adler) {
+
+  // Row offsets are taken in size_t, since posters pass 2 GB of RGBA
+  size_t stride = 1 + 3 * (size_t) width;
+  vector<unsigned char> rows((end_row - first_row) * stride);
+
+  // Each row with the Sub filter, so flat runs become runs of zeros
+  for (int y = first_row; y < end_row; y++) {
+
+    unsigned char* row = &rows[(y - first_row) * stride];
+    const unsigned char* pixel = rgba + 4 * (size_t) y * width;
+
+    row[0] = (mode == STORED) ? 0 : 1;
+
+    for (int x = 0; x < width; x++) {
+      for (int c = 0; c < 3; c++) {
+
+        unsigned char value = pixel[4 * x + c];
+
+        if (mode != STORED && x > 0) {
+          value -= pixel[4 * (x - 1) + c];
+        }
+
+        row[1 + 3 * x + c] = value;
+
+      }
+    }
+
+  }
+
+  *adler = adler32(&rows[0], rows.size());
+
+  begin_chunk(chunk, "IDAT");
+
+  if (mode == STORED) {
+    deflate_stored(&rows[0], rows.size(), &chunk);
+  } else {
+
+    vector<int> head;
+    BitWriter bits(&chunk);
+
+    deflate_fast(&rows[0], rows.size(), &bits, head);
+    bits.flush();
+
+  }
+
+  end_chunk(chunk);
+
+}
+
+// Writes an RGBA image as a PNG, dropping the alpha unless mode is BEST.
+// Returns a lodepng error code, 79 if the file could not be written, or 0.
+unsigned PNGWriter::write(const char* path, const unsigned char* rgba,
+    int width, int height, int mode) {
+
+  if (mode == BEST) {
+    return lodepng_encode32_file(path, rgba, width, height);
+  }
+
+  int band_count = (height + PNG_BAND_ROWS - 1) / PNG_BAND_ROWS;
+
+  vector<vector<unsigned char> > bands(band_count);
+  vector<unsigned int> adlers(band_count);
+
+  #pragma omp parallel for schedule(dynamic)
+  for (int b = 0; b < band_count; b++) {
+    compress_band(rgba, width, b * PNG_BAND_ROWS,
+        min((b + 1) * PNG_BAND_ROWS, height), mode, bands[b], &adlers[b]);
+  }
+
+  PNGStream stream;
+
+  if (!stream.open(path, width, height, mode)) {
+    return 79;
+  }
+
+  for (int b = 0; b < band_count; b++) {
+    int rows = min((b + 1) * PNG_BAND_ROWS, height) - b * PNG_BAND_ROWS;
+    stream.add_band(bands[b], adlers[b], rows);
+  }
+
+  return stream.close() ? 0 : 79;
+
+}
+
+//*****************************************************************************
+// PNGStream
+//*****************************************************************************
+
+// Creates the file, and writes everything that comes before the image data
+bool PNGStream::open(const char* path, int image_width, int image_height,
+    int compression) {
+
+  width = image_width;
+  height = image_height;
+  mode = compression;
+  adler = 1;
+  rows_written = 0;
+
+  file = fopen(path, "wb");
+
+  if (file == NULL) {
+    return false;
+  }
+
+  vector<unsigned char> header;
+  vector<unsigned char> chunk;
+
+  const unsigned char signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+  header.insert(header.end(), signature, signature + 8);
+
+  // 8 bit RGB, not interlaced
+  begin_chunk(chunk, "IHDR");
+  append_uint(chunk, width);
+  append_uint(chunk, height);
+  chunk.push_back(8);
+  chunk.push_back(2);
+  chunk.push_back(0);
+  chunk.push_back(0);
+  chunk.push_back(0);
+  end_chunk(chunk);
+  header.insert(header.end(), chunk.begin(), chunk.end());
+
+  // zlib header, for a 32K window and the fastest level
+  begin_chunk(chunk, "IDAT");
+  chunk.push_back(0x78);
+  chunk.push_back(0x01);
+  end_chunk(chunk);
+  header.insert(header.end(), chunk.begin(), chunk.end());
+
+  failed = fwrite(&header[0], 1, header.size(), file) != header.size();
+
+  return !failed;
+
+}
+
+// Appends a band made by compress_band, which covers the next rows rows
+void PNGStream::add_band(const vector<unsigned char>& chunk,
+    unsigned int band_adler, int rows) {
+
+  // The zlib stream's checksum covers every band in order
+  adler = adler32_combine(adler, band_adler, rows * (1 + 3 * (size_t) width));
+  rows_written += rows;
+
+  failed = failed || fwrite(&chunk[0], 1, chunk.size(), file) != chunk.size();
+
+  // So the rows written so far can be looked at while the rest render
+  fflush(file);
+
+}
+
+// Compresses and appends the next rows rows of the image, from rgba
+void PNGStream::write_rows(const unsigned char* rgba, int rows) {
+
+  vector<unsigned char> chunk;
+  unsigned int band_adler;
+
+  PNGWriter::compress_band(rgba, width, 0, rows, mode, chunk, &band_adler);
+  add_band(chunk, band_adler, rows);
+
+}
+
+// Ends the stream, and closes the file. Returns false if anything could not
+// be written, or not every row was.
+bool PNGStream::close() {
+
+  vector<unsigned char> trailer;
+  vector<unsigned char> chunk;
+
+  // An empty final block with fixed codes, the checksum, and the end
+  begin_chunk(chunk, "IDAT");
+  chunk.push_back(0x03);
+  chunk.push_back(0x00);
+  append_uint(chunk, adler);
+  end_chunk(chunk);
+  trailer.insert(trailer.end(), chunk.begin(), chunk.end());
+
+  begin_chunk(chunk, "IEND");
+  end_chunk(chunk);
+  trailer.insert(trailer.end(), chunk.begin(), chunk.end());
+
+  failed = failed ||
+      fwrite(&trailer[0], 1, trailer.size(), file) != trailer.size();
+  failed = (fclose(file) != 0) || failed;
+
+  return !failed && rows_written == height;
+
+}
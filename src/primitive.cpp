@@ -0,0 +1,25 @@
+#include "primitive.h"
+
+//*****************************************************************************
+// Primitive
+//*****************************************************************************
+
+Primitive::Primitive() {
+
+  shape = NULL;
+  index = 0;
+
+}
+
+Primitive::Primitive(Shape* primitive_shape, int primitive_index) {
+
+  shape = primitive_shape;
+  index = primitive_index;
+
+}
+
+bool Primitive::is(Shape* other_shape, int other_index) {
+
+  return shape == other_shape && index == other_index;
+
+}
@@ -1,9 +1,11 @@
+#include <math.h>
+
 #include "ray.h"
 
 Ray::Ray() {
   
   position = Vector(0, 0, 0);
-  direction = Vector(0, 0, 0);
+  set_direction(Vector(0, 0, 0));
   t_min = 0;
   t_max = 0;
   into = true;
@@ -13,13 +15,38 @@ Ray::Ray() {
 Ray::Ray(Vector pos, Vector dir, float min, float max) {
   
   position = pos;
-  direction = dir;
+  set_direction(dir);
   t_min = min;
   t_max = max;
   into = true;
   
 }
 
+// Components too close to zero get a huge but finite inverse, so box tests
+// never compute 0 * inf
+static float safe_inverse(float value) {
+
+  if (fabs(value) > 1e-30) {
+    return 1 / value;
+  }
+
+  return (value < 0) ? -1e30 : 1e30;
+
+}
+
+void Ray::set_direction(Vector dir) {
+
+  direction = dir;
+
+  inv_direction = Vector(safe_inverse(dir.x), safe_inverse(dir.y), 
+      safe_inverse(dir.z));
+
+  sign[0] = (inv_direction.x < 0);
+  sign[1] = (inv_direction.y < 0);
+  sign[2] = (inv_direction.z < 0);
+
+}
+
 void Ray::print(Ray input) {
   
   printf("Ray:\n");
@@ -20,28 +20,29 @@ Vector Raytracer::reflection_v(Vector direction, Vector normal) {
 
 }
 
-bool Raytracer::shadow_ray(Scene* scene, Ray ray, Shape* shape) {
+// Only needs to know whether anything lies between the surface and the light
+bool Raytracer::shadow_ray(Scene* scene, Ray ray, Primitive surface) {
 
-  Shape* surface = scene->bbox_tree->intersect_object(ray, shape);
-  return (surface != NULL);
+  return scene->bbox_tree->occluded(ray, surface);
 
 }
 
-void Raytracer::shine_dir_lights(Shape* shape, Vector *color, Scene* scene, 
-    Material material, Vector surface, Vector viewer, Vector normal) {
+void Raytracer::shine_dir_lights(Primitive prim, Vector *color, 
+    Scene* scene, const Material& material, const Vector& surface, 
+    const Vector& viewer, const Vector& normal) {
 
   // Iterate through directional lights
   for (unsigned i = 0; i < scene->dir_lights.size(); i++) {
 
     // Get current directional light
-    DirLight dir_light = scene->dir_lights[i];
+    const DirLight& dir_light = scene->dir_lights[i];
     // Have direction of light->surface, want direction of surface->light
     Vector light_direction = -1 * dir_light.direction;
 
     // Dodge shadows
     Ray light_ray = Ray(surface, light_direction, 0, 10000);
 
-    if (shadow_ray(scene, light_ray, shape)) {
+    if (shadow_ray(scene, light_ray, prim)) {
       continue;
     }
 
@@ -56,23 +57,24 @@ void Raytracer::shine_dir_lights(Shape* shape, Vector *color, Scene* scene,
 
 }
 
-void Raytracer::shine_point_lights(Shape *shape, Vector *color, Scene* scene, 
-    Material material, Vector surface, Vector viewer, Vector normal) {
+void Raytracer::shine_point_lights(Primitive prim, Vector *color, 
+    Scene* scene, const Material& material, const Vector& surface, 
+    const Vector& viewer, const Vector& normal) {
 
   // Iterate through point lights
   for (unsigned i = 0; i < scene->point_lights.size(); i++) {
 
-    PointLight point_light = scene->point_lights[i];
+    const PointLight& point_light = scene->point_lights[i];
 
     Vector light_direction = point_light.position - surface;
     float light_distance = light_direction.len();
 
     light_direction = light_direction.normalize();
 
-    // Dodge shadows
-    Ray light_ray = Ray(surface, light_direction, 0, 10000);
+    // Dodge shadows, but only from things in front of the light
+    Ray light_ray = Ray(surface, light_direction, 0, light_distance);
 
-    if (shadow_ray(scene, light_ray, shape)) {
+    if (shadow_ray(scene, light_ray, prim)) {
       continue;
     }
 
@@ -99,51 +101,76 @@ void Raytracer::shine_point_lights(Shape *shape, Vector *color, Scene* scene,
 }
 
 void Raytracer::shine_ambient_lights(Vector *color, Scene* scene, 
-    Material material) {
+    const Material& material) {
  
   // Iterate through ambient lights
   for (unsigned i = 0; i < scene->ambient_lights.size(); i++) {
-    Light ambient_light = scene->ambient_lights[i];
+    const Light& ambient_light = scene->ambient_lights[i];
     *color = *color + material.ambient_c(ambient_light.color);
   }
   
 }
 
+// Traces view_ray into color, clamped to 1 at every bounce as the PNG has
+// always been made. When radiance is given, the same light goes into it
+// without any clamping, for HDR output.
 void Raytracer::trace(Scene* scene, Ray view_ray, int depth, Vector* color,
-    Shape* last_shape) {
+    Vector* radiance, Primitive last_prim) {
 
   if (depth > max_depth) {
     *color = Vector(0.0, 0.0, 0.0);
+
+    if (radiance) {
+      *radiance = Vector();
+    }
+
     return;
   }
   
-  Shape* closest_shape = scene->bbox_tree->intersect_object(view_ray, last_shape);
+  HitRecord hit;
 
-  if (closest_shape == NULL) {
+  if (!scene->bbox_tree->intersect_closest(view_ray, last_prim, &hit)) {
     *color = Vector();
+
+    if (radiance) {
+      *radiance = Vector();
+    }
+
     return;
   }
 
-  Vector intersect = closest_shape->intersectP(view_ray);
-  Vector normal = closest_shape->get_normal(intersect); 
+  Primitive closest_prim = Primitive(hit.shape, hit.index);
+  const Material& material = scene->materials[hit.shape->material];
+
+  Vector intersect = hit.point;
+  Vector normal = hit.shading_normal;
 
   Vector viewer = view_ray.position - intersect;
   viewer = viewer.normalize();
 
-  shine_dir_lights(closest_shape, color, scene, closest_shape->material,
-    intersect, viewer, normal);
-  shine_point_lights(closest_shape, color, scene, closest_shape->material, 
+  shine_dir_lights(closest_prim, color, scene, material, intersect, viewer, 
+      normal);
+  shine_point_lights(closest_prim, color, scene, material, 
       intersect, viewer, normal);
 
   if (depth < 1) {
-    shine_ambient_lights(color, scene, closest_shape->material);
+    shine_ambient_lights(color, scene, material);
+  }
+
+  // Nothing has been clamped yet
+  if (radiance) {
+    *radiance = *color;
   }
 
+  // Unclamped light of the rays traced from here, if it is wanted at all
+  Vector sub_radiance;
+  Vector* sub = radiance ? &sub_radiance : NULL;
+
    // Do the reflection thing
-  if (!(closest_shape->material.refract &&
-      closest_shape->material.reflective.x) > 0 || 
-      closest_shape->material.reflective.y > 0 ||
-      closest_shape->material.reflective.z > 0) {
+  if ((!material.refract &&
+      material.reflective.x > 0) || 
+      material.reflective.y > 0 ||
+      material.reflective.z > 0) {
 
     Vector reflec_color;
 
@@ -152,15 +179,20 @@ void Raytracer::trace(Scene* scene, Ray view_ray, int depth, Vector* color,
 
     Ray reflec_ray = Ray(intersect, reflection, 0, 10000);
 
-    trace(scene, reflec_ray, depth + 1, &reflec_color, closest_shape);
-    reflec_color = Vector::point_multiply(closest_shape->material.reflective, 
+    trace(scene, reflec_ray, depth + 1, &reflec_color, sub, closest_prim);
+    reflec_color = Vector::point_multiply(material.reflective, 
         reflec_color);
 
     *color = *color + reflec_color;
+
+    if (radiance) {
+      *radiance = *radiance + Vector::point_multiply(material.reflective,
+          sub_radiance);
+    }
   }
 
   // Do the refraction thing
-  if(closest_shape->material.refract){
+  if(material.refract){
     Vector dir = view_ray.direction.normalize();
     float dn = Vector::dot(dir, normal);
     bool skipR = false;
@@ -168,36 +200,45 @@ void Raytracer::trace(Scene* scene, Ray view_ray, int depth, Vector* color,
     float c;
     Ray refracted;
     if(dn < 0) {
-      refracted = refract(dir, normal, closest_shape->material.glassIndex, closest_shape->material, intersect); //returns t
+      refracted = refract(dir, normal, material.glassIndex, material, intersect); //returns t
       c = -1.0*dn;
       kvector = Vector(1,1,1);
-      //printf("%f\n", closest_shape->material.glassIndex);
+      //printf("%f\n", material.glassIndex);
     }
     else {
       Vector partial = Vector(0.2, 0.2, 0.2);
       //Vector::print(partial);
       kvector = Vector(expf(partial.x), expf(partial.y), expf(partial.z));
-      if(canRefract(dir, -1.0*normal, 1/closest_shape->material.glassIndex, closest_shape->material)) {
-        refracted = refract(dir, -1.0*normal, 1/closest_shape->material.glassIndex, closest_shape->material, intersect);
+      if(canRefract(dir, -1.0*normal, 1/material.glassIndex, material)) {
+        refracted = refract(dir, -1.0*normal, 1/material.glassIndex, material, intersect);
         c = Vector::dot(refracted.direction.normalize(), normal);
       }
       else{
         Vector d_color = Vector(0,0,0);
-        trace(scene, view_ray, depth + 1, &d_color, closest_shape);
+        trace(scene, view_ray, depth + 1, &d_color, sub, closest_prim);
         *color = *color + Vector::point_multiply(kvector, d_color);
+        if (radiance) {
+          *radiance = *radiance + Vector::point_multiply(kvector, sub_radiance);
+        }
         skipR = true;
       }
     }
     if(!skipR){
-      float R0 = pow((closest_shape->material.glassIndex - 1), 2) / pow((closest_shape->material.glassIndex + 1), 2);
+      float R0 = pow((material.glassIndex - 1), 2) / pow((material.glassIndex + 1), 2);
       float Rk = R0 + (1-R0)*pow(1-c, 5);
       Vector d_color = Vector(0,0,0);
-      trace(scene, view_ray, depth + 1, &d_color, closest_shape);
+      Vector d_radiance;
+      trace(scene, view_ray, depth + 1, &d_color, sub, closest_prim);
+      d_radiance = sub_radiance;
       Vector r_color = Vector(0,0,0);
-      trace(scene, refracted, depth + 1, &r_color, closest_shape);
+      trace(scene, refracted, depth + 1, &r_color, sub, closest_prim);
       Vector part1 = Vector::point_multiply(kvector, d_color);
       Vector part2 = Vector::point_multiply(kvector, r_color);
       *color = *color + Rk*part1 + (1-Rk)*part2;
+      if (radiance) {
+        *radiance = *radiance + Rk*Vector::point_multiply(kvector, d_radiance) +
+            (1-Rk)*Vector::point_multiply(kvector, sub_radiance);
+      }
     }
    
 
@@ -210,7 +251,7 @@ void Raytracer::trace(Scene* scene, Ray view_ray, int depth, Vector* color,
 
 }
 
-bool Raytracer::canRefract(Vector direction, Vector normal, float ind, Material material) {
+bool Raytracer::canRefract(Vector direction, Vector normal, float ind, const Material& material) {
   float n = 1/ind;
   Vector norm = normal;
   Vector D =  direction;
@@ -219,7 +260,7 @@ bool Raytracer::canRefract(Vector direction, Vector normal, float ind, Material
   return cos2 > 0.0;
 }
 
-Ray Raytracer::refract(Vector direction, Vector normal, float ind, Material material, Vector intersect) {
+Ray Raytracer::refract(Vector direction, Vector normal, float ind, const Material& material, Vector intersect) {
      //do refract
     float n = 1/ind;
     float cos1 = Vector::dot(direction, normal); // n dot d)
@@ -0,0 +1,42 @@
+#include "rng.h"
+
+//*****************************************************************************
+// RNG
+//*****************************************************************************
+
+// Scrambles the seed with the SplitMix64 finalizer, so neighbouring pixels
+// and samples start from unrelated states
+RNG::RNG(unsigned long long seed, unsigned long long stream) {
+
+  seed ^= seed >> 30;
+  seed *= 0xbf58476d1ce4e5b9ULL;
+  seed ^= seed >> 27;
+  seed *= 0x94d049bb133111ebULL;
+  seed ^= seed >> 31;
+
+  state = 0;
+  increment = (stream << 1) | 1;
+  next_uint();
+  state += seed;
+  next_uint();
+
+}
+
+unsigned int RNG::next_uint() {
+
+  unsigned long long old_state = state;
+  state = old_state * 6364136223846793005ULL + increment;
+
+  unsigned int xorshifted = ((old_state >> 18) ^ old_state) >> 27;
+  unsigned int rotation = old_state >> 59;
+
+  return (xorshifted >> rotation) | (xorshifted << ((-rotation) & 31));
+
+}
+
+// Uniform in [0, 1), from the top 24 bits so every value is exactly a float
+float RNG::next_float() {
+
+  return (next_uint() >> 8) * (1.0f / 16777216.0f);
+
+}
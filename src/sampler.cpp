@@ -1,46 +1,305 @@
+#include <algorithm>
+#include <math.h>
+
 #include "sampler.h"
 
+#ifndef RNG_H
+#include "rng.h"
+#endif
+
+#ifndef BLUENOISE_H
+#include "bluenoise.h"
+#endif
+
 using namespace std;
 
+// Largest float below 1, so offsets never land on the next pixel
+#define ONE_MINUS_EPSILON 0x1.fffffep-1f
+
+// Generators of the R2 sequence, the 2D rank-1 lattice with the best known
+// spacing (Roberts, "The unreasonable effectiveness of quasirandom sequences")
+#define R2_ALPHA_X 0.7548776662466927
+#define R2_ALPHA_Y 0.5698402909980532
+
+//*****************************************************************************
+// Sequences
+//*****************************************************************************
+
+static unsigned int reverse_bits(unsigned int x) {
+
+  x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+  x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+  x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+  x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+
+  return (x >> 16) | (x << 16);
+
+}
+
+// Hash-based Owen scrambling (Burley, "Practical Hash-based Owen Scrambling",
+// JCGT 2020). The Laine-Karras permutation only lets each bit depend on the
+// bits below it, so reversing around it gives the nested uniform scramble,
+// where each bit depends on the bits above.
+static unsigned int laine_karras_permutation(unsigned int x, unsigned int seed) {
+
+  x += seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+
+  return x;
+
+}
+
+static unsigned int nested_uniform_scramble(unsigned int x, unsigned int seed) {
+
+  return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+
+}
+
+// The first two Sobol dimensions, as 32 bit binary fractions
+static unsigned int sobol_x(unsigned int index) {
+
+  return reverse_bits(index);
+
+}
+
+static unsigned int sobol_y(unsigned int index) {
+
+  unsigned int result = 0;
+
+  for (unsigned int v = 1u << 31; index; index >>= 1, v ^= v >> 1) {
+    if (index & 1) {
+      result ^= v;
+    }
+  }
+
+  return result;
+
+}
+
+static float binary_fraction(unsigned int x) {
+
+  return fminf(x * 0x1p-32f, ONE_MINUS_EPSILON);
+
+}
+
+// Radical inverse of index in base 3, the Halton sequence's second dimension
+// (the first is base 2, which is just the reversed bits)
+static float radical_inverse_3(unsigned int index) {
+
+  double inverse = 0;
+  double digit = 1.0 / 3;
+
+  for (; index; index /= 3, digit /= 3) {
+    inverse += (index % 3) * digit;
+  }
+
+  return fminf((float) inverse, ONE_MINUS_EPSILON);
+
+}
+
+// Fractional part of x + shift, for x and shift in [0, 1)
+static float rotate(float x, float shift) {
+
+  x += shift;
+
+  return fminf((x >= 1) ? x - 1 : x, ONE_MINUS_EPSILON);
+
+}
+
 //*****************************************************************************
 // Sampler
 //*****************************************************************************
 
-void Sampler::get_points(vector<Vector>* points, Camera* camera, int i, int j, int width, int height) {
+// ASSUMING A FLAT VIEWING PLANE (IE NOT CURVED)
+Sampler::Sampler(Camera* sampler_camera, int image_width, int image_height) {
+
+  camera = sampler_camera;
+  width = image_width;
+  height = image_height;
+
+  left_edge = camera->lLeft - camera->uLeft;
+  right_edge = camera->lRight - camera->uRight;
+
+  left_step = left_edge / height;
+  span_step = (right_edge - left_edge) / height;
+
+  current_row = -1;
+
+}
+
+// Shared setup that has to happen before the render threads start
+void Sampler::prepare() {
+
+  if (strategy == BLUE_NOISE && (samples > 1 || adaptive())) {
+    BlueNoise::generate();
+  }
+
+}
+
+bool Sampler::adaptive() {
+
+  return max_samples > 0;
 
-  // ASSUMING A FLAT VIEWING PLANE (IE NOT CURVED)
+}
 
-  // Find coords of center of pixel in viewing plane
+// Samples every pixel gets before adaptive sampling looks at its error
+int Sampler::base_samples() {
 
-  // Declarations
+  if (!adaptive()) {
+    return samples;
+  }
 
-  Vector left;
-  Vector right;
-  Vector result;
+  return min(max(samples, MIN_ADAPTIVE_SAMPLES), max_samples);
 
-  // Generate x * y random samples 
+}
 
-  float off_x;
-  float off_y;
+// Most points a single get_points call is asked for
+int Sampler::buffer_size() {
 
-  for (int y = 0; y < samples; y++) {
-    for (int x = 0; x < samples; x++) {
+  return max(base_samples(), MIN_ADAPTIVE_SAMPLES);
 
-      if (samples == 1) {
-        off_x = x + 0.5;
-        off_y = y + 0.5; 
+}
+
+// Hoists the ends of pixel row j out of the per pixel work
+void Sampler::set_row(int j) {
+
+  row_left = camera->uLeft + left_edge * (j + 0.5f) / height;
+  row_right = camera->uRight + right_edge * (j + 0.5f) / height;
+
+  row_top_left = camera->uLeft + left_step * j;
+  row_top_span = camera->uRight - camera->uLeft + span_step * j;
+
+  current_row = j;
+
+}
+
+// The point at (off_x, off_y) within pixel i of the current row, offsets in
+// [0, 1). Only off_y has to be applied to the row's ends per point.
+Vector Sampler::point(int i, float off_x, float off_y) {
+
+  Vector left = row_top_left + left_step * off_y;
+  Vector span = row_top_span + span_step * off_y;
+
+  return left + span * (i + off_x) / width;
+
+}
+
+// Writes points first to first + count - 1 of pixel (i, j) into points, and
+// returns how many there are. Every strategy gives the same points for a
+// pixel on every run, whichever thread draws it.
+int Sampler::get_points(Vector* points, int i, int j, int first, int count) {
+
+  int written = 0;
+  unsigned long long pixel = (unsigned long long) j * width + i;
+
+  if (j != current_row) {
+    set_row(j);
+  }
+
+  if (samples == 1 && !adaptive()) {
+
+    points[written++] = row_left + (row_right - row_left) * (i + 0.5f) / width;
+
+    return written;
+
+  }
+
+  if (strategy == JITTER) {
+
+    // The first rows * columns points are jittered in a grid about as
+    // square as samples allows, and any past that are uniformly random.
+    // Counts that rows divides, squares among them, fill the grid, and the
+    // others leave fewer than rows points over.
+    int rows = (int) sqrt((double) samples);
+    int columns = samples / rows;
+
+    for (int s = first; s < first + count; s++) {
+
+      RNG rng(pixel, s);
+
+      float off_x;
+      float off_y;
+
+      if (s < rows * columns) {
+        off_x = (s % columns + rng.next_float()) / columns;
+        off_y = (s / columns + rng.next_float()) / rows;
       } else {
-        off_x = (x + (((float) rand()) / RAND_MAX)) / samples;
-        off_y = (y + (((float) rand()) / RAND_MAX)) / samples; 
+        off_x = rng.next_float();
+        off_y = rng.next_float();
       }
 
-      left = camera->uLeft + (camera->lLeft - camera->uLeft) * (j + off_y) / height;
-      right = camera->uRight + (camera->lRight - camera->uRight) * (j + off_y) / height;
-      result = left + (right - left) * (i + off_x) / width;
+      points[written++] = point(i, off_x, off_y);
+
+    }
+
+    return written;
 
-      points->push_back(result);
+  }
+
+  RNG rng(pixel, 0);
+
+  if (strategy == SOBOL) {
+
+    // Shuffle the order of the points as well as scrambling them. The
+    // shuffle keeps aligned power of two runs together, so every such prefix
+    // of a pixel's points is still well spread.
+    unsigned int index_seed = rng.next_uint();
+    unsigned int x_seed = rng.next_uint();
+    unsigned int y_seed = rng.next_uint();
+
+    for (int s = first; s < first + count; s++) {
+
+      unsigned int index = nested_uniform_scramble(s, index_seed);
+
+      float off_x = binary_fraction(
+          nested_uniform_scramble(sobol_x(index), x_seed));
+      float off_y = binary_fraction(
+          nested_uniform_scramble(sobol_y(index), y_seed));
+
+      points[written++] = point(i, off_x, off_y);
+
+    }
+
+  } else if (strategy == HALTON) {
+
+    // Cranley-Patterson rotation, so neighbouring pixels do not alias
+    float shift_x = rng.next_float();
+    float shift_y = rng.next_float();
+
+    for (int s = first; s < first + count; s++) {
+
+      float off_x = rotate(binary_fraction(reverse_bits(s)), shift_x);
+      float off_y = rotate(radical_inverse_3(s), shift_y);
+
+      points[written++] = point(i, off_x, off_y);
+
+    }
+
+  } else {
+
+    // Offsets for the two dimensions from far apart parts of the mask, so
+    // they are not correlated
+    double start_x = BlueNoise::value(i, j);
+    double start_y = BlueNoise::value(i + BLUE_NOISE_SIZE / 2,
+        j + BLUE_NOISE_SIZE / 2);
+
+    for (int s = first; s < first + count; s++) {
+
+      double x = start_x + s * R2_ALPHA_X;
+      double y = start_y + s * R2_ALPHA_Y;
+
+      float off_x = fminf((float) (x - floor(x)), ONE_MINUS_EPSILON);
+      float off_y = fminf((float) (y - floor(y)), ONE_MINUS_EPSILON);
+
+      points[written++] = point(i, off_x, off_y);
 
     }
-  }  
 
-}
\ No newline at end of file
+  }
+
+  return written;
+
+}
@@ -4,6 +4,10 @@
 #include "raytracer.h"
 #endif
 
+#ifndef BLUENOISE_H
+#include "bluenoise.h"
+#endif
+
 //*****************************************************************************
 // Scene
 //*****************************************************************************
@@ -14,6 +18,34 @@ void Scene::add_surface(Shape* surface) {
 
 }
 
+void Scene::add_mesh(TriangleMesh* mesh) {
+
+  meshes.push_back(mesh);
+
+}
+
+// Returns the index of material in the material table, adding it if no
+// identical material is there yet. Scenes only have a handful of materials,
+// so a linear search is plenty.
+unsigned short Scene::add_material(const Material& material) {
+
+  for (unsigned int i = 0; i < materials.size(); i++) {
+    if (materials[i].equals(material)) {
+      return i;
+    }
+  }
+
+  if (materials.size() == MAX_MATERIALS) {
+    cerr << "Error: More than " << MAX_MATERIALS << " materials" << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  materials.push_back(material);
+
+  return materials.size() - 1;
+
+}
+
 void Scene::add_dir_light(DirLight dir_light) {
   
   dir_lights.push_back(dir_light);
@@ -32,48 +64,317 @@ void Scene::add_ambient_light(Light ambient_light) {
   
 }
 
+// Renders the film tile by tile. Threads take tiles from the scheduler until
+// none are left, stealing from each other once their own run is done. With
+// more than one pass, every pass adds samples to the pixels that still want
+// them, and the image is written after each so it can be looked at early.
 void Scene::render() {
 
+  TileScheduler scheduler(film.width, film.height, Film::streaming);
+  Sampler::prepare();
+
+  if (Film::streaming) {
+    film.begin_stream(TileScheduler::tile_size, (film.width +
+        TileScheduler::tile_size - 1) / TileScheduler::tile_size);
+  }
+
+  // Tiles of the current pass already in the film
+  vector<char> done(scheduler.tiles.size(), 0);
+  int first_pass = 0;
+
+  if (resume) {
+
+    if (!Checkpoint::load(&film, identity, checkpoint, &first_pass, done)) {
+      cerr << "Error: Could not resume from " << checkpoint << endl;
+      exit(EXIT_FAILURE);
+    }
+
+    printf("Checkpoint: resumed %s at pass %d\n", checkpoint.c_str(),
+        first_pass + 1);
+
+  }
+
+  // Finished tiles are added to the film under this lock, so a checkpoint
+  // never holds part of a tile. One thread at a time copies the film for a
+  // checkpoint under it too, and writes the copy once the lock is released.
+  omp_lock_t film_lock;
+  omp_init_lock(&film_lock);
+
+  Checkpoint snapshot;
+  bool writing = false;
+
+  double start_time = omp_get_wtime();
+  double next_checkpoint = start_time + checkpoint_interval;
+
+  for (int pass = first_pass; pass < passes; pass++) {
+
+    long long pass_samples = 0;
+    bool resumed = (pass == first_pass && resume);
+
+    if (pass > first_pass) {
+      scheduler.reset();
+    }
+
+    #pragma omp parallel num_threads(scheduler.thread_count) \
+        reduction(+:pass_samples)
+    {
+      int thread = omp_get_thread_num();
+      Tile tile;
+
+      // Every thread reuses one sampler and one set of buffers for all its
+      // pixels
+      Sampler sampler(&camera, film.width, film.height);
+      vector<Vector> points(Sampler::buffer_size());
+      vector<PixelSamples> updates(TileScheduler::tile_size *
+          TileScheduler::tile_size);
+
+      while (scheduler.next(thread, &tile)) {
+
+        if (done[tile.index]) {
+          continue;
+        }
+
+        double tile_start = omp_get_wtime();
+
+        pass_samples += render_tile(tile, &sampler, &points[0], &updates[0]);
+
+        // Only the rendering counts as busy, not waiting for the film
+        scheduler.queues[thread].busy_time += omp_get_wtime() - tile_start;
+
+        omp_set_lock(&film_lock);
+
+        add_tile(tile, &updates[0]);
+        done[tile.index] = 1;
+
+        bool capture = checkpoint_interval > 0 && !writing &&
+            omp_get_wtime() >= next_checkpoint;
+
+        if (capture) {
+          snapshot.capture(&film, identity, pass, done);
+          writing = true;
+        }
+
+        omp_unset_lock(&film_lock);
+
+        // Finished bands are compressed and written without holding up the
+        // threads adding tiles
+        if (Film::streaming) {
+          film.write_bands();
+        }
+
+        if (capture) {
+
+          save_checkpoint(&snapshot);
+
+          omp_set_lock(&film_lock);
+          next_checkpoint = omp_get_wtime() + checkpoint_interval;
+          writing = false;
+          omp_unset_lock(&film_lock);
+
+        }
+
+      }
+    }
+
+    fill(done.begin(), done.end(), 0);
+
+    if (passes > 1) {
+
+      if (pass_samples == 0 && !resumed) {
+        printf("Pass %d: every pixel has converged\n", pass + 1);
+        break;
+      }
+
+      film.write_to_image();
+
+      printf("Pass %d of %d: %.2f samples per pixel, %fs\n", pass + 1,
+          passes, film.average_samples(), omp_get_wtime() - start_time);
+
+      if (checkpoint_interval > 0 && pass + 1 < passes) {
+        snapshot.capture(&film, identity, pass + 1, done);
+        save_checkpoint(&snapshot);
+        next_checkpoint = omp_get_wtime() + checkpoint_interval;
+      }
+
+    }
+
+  }
+
+  omp_destroy_lock(&film_lock);
+
+  scheduler.report(omp_get_wtime() - start_time);
+  scheduler.dispose();
+
+  if (Sampler::adaptive()) {
+    printf("Samples: %.2f per pixel on average (%d to %d, error %g)\n",
+        film.average_samples(), Sampler::base_samples(),
+        Sampler::max_samples, Sampler::max_error);
+  }
+
+  if (Film::streaming) {
+    film.end_stream();
+  } else if (passes == 1) {
+    film.write_to_image();
+  }
+
+  // The render is complete, so there is nothing left to resume
+  if (checkpoint_interval > 0 || resume) {
+    remove(checkpoint.c_str());
+  }
+
+}
+
+void Scene::save_checkpoint(Checkpoint* snapshot) {
+
+  if (snapshot->save(checkpoint)) {
+    printf("Checkpoint: wrote %s\n", checkpoint.c_str());
+  } else {
+    fprintf(stderr, "Could not write checkpoint %s\n", checkpoint.c_str());
+  }
+
+}
+
+// Adds the samples render_tile took for each pixel of tile to the film
+void Scene::add_tile(const Tile& tile, PixelSamples* updates) {
+
+  int width = tile.x_max - tile.x_min;
+
+  for (int j = tile.y_min; j < tile.y_max; j++) {
+    for (int i = tile.x_min; i < tile.x_max; i++) {
+
+      PixelSamples* samples =
+          &updates[(j - tile.y_min) * width + (i - tile.x_min)];
+
+      if (samples->count > 0) {
+        film.add_samples(i, j, *samples);
+      }
+
+    }
+  }
+
+  if (Film::streaming) {
+    film.finish_tile(tile.y_min / TileScheduler::tile_size);
+  }
+
+}
+
+// Sums the colours seen through points[0, count), last first, the order the
+// samples have always been summed in. Adds up the squares of their
+// luminances too when luminance_squares is given, and their unclamped
+// radiance when radiance_sum is.
+Vector Scene::trace_points(Vector* points, int count,
+    double* luminance_squares, Vector* radiance_sum) {
+
+  Vector pixel_color;
+  Vector pixel_radiance;
+  Vector total_color;
+
+  Ray view_ray;
+  view_ray.position = camera.origin;
+
+  for (int s = count - 1; s >= 0; s--) {
+
+    view_ray.set_direction(points[s] - camera.origin);
+    view_ray.t_min = 0;
+    view_ray.t_max = 10000; 
+
+    Raytracer::trace(this, view_ray, 0, &pixel_color,
+        radiance_sum ? &pixel_radiance : NULL, Primitive());
+
+    total_color = total_color + pixel_color;
+
+    if (radiance_sum) {
+      *radiance_sum += pixel_radiance;
+    }
+
+    if (luminance_squares) {
+      double luminance = Film::luminance(pixel_color);
+      *luminance_squares += luminance * luminance;
+    }
+    
+    // Make sure to reset the colour of the pixel
+    pixel_color = Vector();
+
+  }
+
+  return total_color;
+
+}
+
+// Whether a pixel with samples so far should take more. Without adaptive
+// sampling every pass samples every pixel.
+bool Scene::needs_samples(PixelSamples samples, const PixelSamples& added) {
+
+  if (!Sampler::adaptive()) {
+    return true;
+  }
+
+  samples.add(added);
+
+  return samples.count < Sampler::max_samples &&
+      samples.error() > Sampler::max_error;
+
+}
+
+// Takes a pass worth of samples for the pixels of tile that want them, and
+// leaves them in updates, one per pixel in row order, for add_tile. Returns
+// how many samples that took.
+int Scene::render_tile(const Tile& tile, Sampler* sampler, Vector* points,
+    PixelSamples* updates) {
+
+  int base = Sampler::base_samples();
+  int width = tile.x_max - tile.x_min;
+  int total = 0;
+
   // For each pixel do:
-  #pragma omp parallel for
-  for (int j = 0; j < film.height; j++) {
-    for (int i = 0; i < film.width; i++) {
-      
-      vector<Vector> view_points;
+  for (int j = tile.y_min; j < tile.y_max; j++) {
+    for (int i = tile.x_min; i < tile.x_max; i++) {
 
-      Vector pixel_color;
-      Vector final_color;
+      PixelSamples previous = film.get_samples(i, j);
+      PixelSamples* added =
+          &updates[(j - tile.y_min) * width + (i - tile.x_min)];
 
-      Ray view_ray;
-      view_ray.position = camera.origin;
-      
-      // Compute viewing ray
-      Sampler::get_points(&view_points, &camera, i, j, film.width, film.height);
+      *added = PixelSamples();
 
-      while (!view_points.empty()) {
+      if (previous.count > 0 && !needs_samples(previous, *added)) {
+        continue;
+      }
 
-        view_ray.direction = (view_points.back() - camera.origin);
-        view_ray.t_min = 0;
-        view_ray.t_max = 10000; 
+      double* tracked = Sampler::adaptive() ? &added->luminance_squares : NULL;
+      Vector* radiance = film.radiance ? &added->radiance_sum : NULL;
 
-        Raytracer::trace(this, view_ray, 0, &pixel_color, NULL);
+      // Compute viewing rays
+      int count = base;
 
-        final_color = final_color + pixel_color;
-        
-        // Make sure to reset the colour of the pixel
-        pixel_color = Vector();
+      if (Sampler::adaptive()) {
+        count = min(count, Sampler::max_samples - previous.count);
+      }
+
+      count = sampler->get_points(points, i, j, previous.count, count);
+      added->color_sum = trace_points(points, count, tracked, radiance);
+      added->count = count;
+
+      // In a single pass, keep adding a few samples at a time until the
+      // pixel's mean is known well enough, or it reaches the cap
+      while (passes == 1 && Sampler::adaptive() &&
+          needs_samples(previous, *added)) {
+
+        int taken = previous.count + added->count;
 
-        view_points.pop_back();
+        count = min(MIN_ADAPTIVE_SAMPLES, Sampler::max_samples - taken);
+        count = sampler->get_points(points, i, j, taken, count);
+
+        added->color_sum += trace_points(points, count, tracked, radiance);
+        added->count += count;
 
       }
 
-      final_color = final_color / (Sampler::samples * Sampler::samples);
-      film.set_pixel(i, j, final_color);
+      total += added->count;
 
     }
   }
-  
-  film.write_to_image();
+
+  return total;
 
 }
 
@@ -81,5 +382,6 @@ void Scene::dispose() {
  
   film.dispose();
   bbox_tree->dispose();
+  BlueNoise::dispose();
   
 }
\ No newline at end of file
@@ -6,28 +6,39 @@
 
 Sphere::Sphere() {
 
-  transform = Matrix::identity_matrix();
+  set_transform(Matrix::identity_matrix());
   center = Vector(0, 0, 0);
-  material = Material();
+  material = 0;
   radius = 1;
   
 }
 
-Sphere::Sphere(Matrix trans, Vector cen, float rad, Material mat) {
+Sphere::Sphere(Matrix trans, Vector cen, float rad, unsigned short mat) {
 
-  transform = trans;
+  set_transform(trans);
   center = cen;
   radius = rad;
   material = mat;
 
 }
 
-bool Sphere::intersect(Ray ray) {
+int Sphere::primitive_count() {
 
-  ray = transform_ray(ray);
+  return 1;
 
-  Vector pos = ray.position;
-  Vector dir = ray.direction;
+}
+
+BoundingBox Sphere::primitive_bbox(int index) {
+
+  return bbox;
+
+}
+
+// Nearest root of the sphere's quadratic within [t_min, t_max], or -1
+float Sphere::solve(const Ray& ray) {
+
+  Vector pos = local_point(ray.position);
+  Vector dir = local_direction(ray.direction);
 
   float a = Vector::dot(dir, dir);
   float b = 2 * (Vector::dot(dir, pos - center));
@@ -35,90 +46,143 @@ bool Sphere::intersect(Ray ray) {
 
   float discriminant = b * b - 4 * a * c;
 
-  if (discriminant >= 0)  {
+  if (discriminant < 0) {
+    return -1;
+  }
 
-    float t1 = (-b - sqrt(discriminant)) / (2 * a);
-    float t2 = (-b + sqrt(discriminant)) / (2 * a);
+  float t1 = (-b - sqrt(discriminant)) / (2 * a);
+  float t2 = (-b + sqrt(discriminant)) / (2 * a);
 
-    if ((t1 >= ray.t_min && t1 <= ray.t_max) || 
-        (t2 >= ray.t_min && t2 <= ray.t_max)) {
-      return true;
-    }
+  if (t1 >= ray.t_min && t1 <= ray.t_max) {
+    return t1;
+  } else if (t2 >= ray.t_min && t2 <= ray.t_max) {
+    return t2;
+  }
 
+  return -1;
+
+}
+
+// Solves the quadratic once, and takes the normal from the same root
+bool Sphere::intersect(const Ray& ray, int index, HitRecord& hit) {
+
+  float t = solve(ray);
+
+  if (t < 0) {
+    return false;
   }
 
-  return false;
+  hit.t = t;
+  hit.beta = 0;
+  hit.gamma = 0;
+
+  fill_hit(ray, index, hit);
+
+  return true;
 
 }
 
-// Assuming we only care about the first intersection point
-Vector Sphere::intersectP(Ray ray) {
+void Sphere::fill_hit(const Ray& ray, int index, HitRecord& hit) {
 
-  Vector pos = ray.position;
-  Vector dir = ray.direction;
+  hit.point = ray.position + ray.direction * hit.t;
 
-  float t = intersectT(ray);
+  // Normal in the sphere's space, then back out with the inverse transpose
+  Vector local_normal = (local_point(hit.point) - center) / radius;
 
-  if (t >= ray.t_min && t <= ray.t_max) {
-    return pos + (t * dir);
+  if (identity) {
+    hit.normal = local_normal;
   } else {
-    return Vector(std::numeric_limits<float>::infinity(), 
-        std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity());
+    hit.normal.x = normal_matrix[0] * local_normal.x + 
+        normal_matrix[1] * local_normal.y + normal_matrix[2] * local_normal.z;
+    hit.normal.y = normal_matrix[3] * local_normal.x + 
+        normal_matrix[4] * local_normal.y + normal_matrix[5] * local_normal.z;
+    hit.normal.z = normal_matrix[6] * local_normal.x + 
+        normal_matrix[7] * local_normal.y + normal_matrix[8] * local_normal.z;
   }
 
+  hit.normal = hit.normal.normalize();
+  hit.shading_normal = hit.normal;
+
+  // Longitude and latitude on the untransformed sphere
+  hit.u = 0.5 + atan2(local_normal.z, local_normal.x) / (2 * M_PI);
+  hit.v = 0.5 - asin(max(-1.0f, min(1.0f, local_normal.y))) / M_PI;
+
 }
 
-float Sphere::intersectT(Ray ray) {
+bool Sphere::occludes(const Ray& ray, int index) {
 
-  ray = transform_ray(ray);
+  return solve(ray) >= 0;
 
-  Vector pos = ray.position;
-  Vector dir = ray.direction;
+}
 
-  float a = Vector::dot(dir, dir);
-  float b = 2 * (Vector::dot(dir, pos - center));
-  float c = Vector::dot(pos - center, pos - center) - radius * radius;
+bool Sphere::get_triangle(int index, Vector* v1, Vector* v2, Vector* v3) {
 
-  float discriminant = b * b - 4 * a * c;
+  return false;
+
+}
+
+// Sets the world to sphere space transform, and unpacks it once into the
+// forms the intersection and shading code read
+void Sphere::set_transform(Matrix world_to_local) {
 
-  if (discriminant >= 0)  {
+  Matrix identity_transform = Matrix::identity_matrix();
 
-    float t1 = (-b - sqrt(discriminant)) / (2 * a);
-    float t2 = (-b + sqrt(discriminant)) / (2 * a);
+  transform = world_to_local;
+  identity = true;
 
-    if (t1 >= ray.t_min && t1 <= ray.t_max) {
-      return t1;
-    } else if (t2 >= ray.t_min && t2 <= ray.t_max) {
-      return t2;
-    } else {
-      return -1;
+  for (int i = 0; i < 16; i++) {
+    if (transform.matrix[i] != identity_transform.matrix[i]) {
+      identity = false;
     }
+  }
 
+  for (int row = 0; row < 3; row++) {
+    for (int column = 0; column < 4; column++) {
+      affine[row * 4 + column] = transform.get_value(column, row);
+    }
   }
 
-  return -1;
+  // The transpose of the world to local matrix is the inverse transpose of
+  // the sphere's own transform
+  for (int row = 0; row < 3; row++) {
+    for (int column = 0; column < 3; column++) {
+      normal_matrix[row * 3 + column] = transform.get_value(row, column);
+    }
+  }
 
 }
 
-Vector Sphere::get_normal(Vector intersection) {
+// Same arithmetic as Matrix::transform, without copying the matrix or 
+// computing the unused fourth row
+Vector Sphere::local_point(const Vector& point) {
 
-  intersection = Matrix::transform(transform, intersection);
-
-  Vector normal = (intersection - center) / radius;
-  Matrix transpose_inverse = Matrix::transpose(transform);
+  if (identity) {
+    return point;
+  }
 
-  return Matrix::transform(transpose_inverse, normal).normalize(); 
+  return Vector(
+      affine[0] * point.x + affine[1] * point.y + affine[2] * point.z + 
+          affine[3],
+      affine[4] * point.x + affine[5] * point.y + affine[6] * point.z + 
+          affine[7],
+      affine[8] * point.x + affine[9] * point.y + affine[10] * point.z + 
+          affine[11]);
 
 }
 
-Ray Sphere::transform_ray(Ray ray) {
+Vector Sphere::local_direction(const Vector& direction) {
 
-  Vector new_position = Matrix::transform(transform, ray.position);
-  Vector new_direction = Matrix::transform_dir(transform, ray.direction);
-
-  Ray new_ray = Ray(new_position, new_direction, ray.t_min, ray.t_max);
+  if (identity) {
+    return direction;
+  }
 
-  return new_ray;
+  return Vector(
+      affine[0] * direction.x + affine[1] * direction.y + 
+          affine[2] * direction.z,
+      affine[4] * direction.x + affine[5] * direction.y + 
+          affine[6] * direction.z,
+      affine[8] * direction.x + affine[9] * direction.y + 
+          affine[10] * direction.z);
 
 }
 
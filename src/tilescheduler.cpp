@@ -0,0 +1,232 @@
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "tilescheduler.h"
+
+using namespace std;
+
+//*****************************************************************************
+// TileScheduler
+//*****************************************************************************
+
+// Interleaves the bits of x and y, so sorting by the code walks the tile grid
+// along a Z-order curve
+static unsigned int morton_code(unsigned int x, unsigned int y) {
+
+  unsigned int code = 0;
+
+  for (int bit = 0; bit < 16; bit++) {
+    code |= ((x >> bit) & 1) << (2 * bit);
+    code |= ((y >> bit) & 1) << (2 * bit + 1);
+  }
+
+  return code;
+
+}
+
+// Orders tiles by the Morton code of their position in the grid
+class TileMortonCompare {
+
+  public:
+
+    int size;
+
+    TileMortonCompare(int tile_size) {
+      size = tile_size;
+    }
+
+    bool operator()(const Tile& a, const Tile& b) const {
+      return morton_code(a.x_min / size, a.y_min / size) <
+          morton_code(b.x_min / size, b.y_min / size);
+    }
+
+};
+
+TileScheduler::TileScheduler(int width, int height, bool row_order) {
+
+  in_order = row_order;
+
+  for (int y = 0; y < height; y += tile_size) {
+    for (int x = 0; x < width; x += tile_size) {
+
+      Tile tile;
+      tile.x_min = x;
+      tile.y_min = y;
+      tile.x_max = min(x + tile_size, width);
+      tile.y_max = min(y + tile_size, height);
+
+      tiles.push_back(tile);
+
+    }
+  }
+
+  if (!in_order) {
+    sort(tiles.begin(), tiles.end(), TileMortonCompare(tile_size));
+  }
+
+  for (unsigned int i = 0; i < tiles.size(); i++) {
+    tiles[i].index = i;
+  }
+
+  thread_count = (threads > 0) ? threads : omp_get_max_threads();
+
+  if (posix_memalign((void**) &queues, 64,
+      thread_count * sizeof(TileQueue))) {
+    fprintf(stderr, "Could not allocate %d tile queues\n", thread_count);
+    exit(EXIT_FAILURE);
+  }
+
+  for (int t = 0; t < thread_count; t++) {
+
+    omp_init_lock(&queues[t].lock);
+    queues[t].busy_time = 0;
+    queues[t].tiles_rendered = 0;
+    queues[t].tiles_stolen = 0;
+
+  }
+
+  reset();
+
+}
+
+// Hands out every tile again, for another pass over the film. Each thread
+// starts with an equal run of consecutive tiles.
+void TileScheduler::reset() {
+
+  int count = tiles.size();
+
+  next_tile = 0;
+
+  for (int t = 0; t < thread_count; t++) {
+    queues[t].front = (long) count * t / thread_count;
+    queues[t].back = (long) count * (t + 1) / thread_count;
+  }
+
+}
+
+// Hands thread its next tile, stealing when its own queue is empty. Returns
+// false once every queue is empty.
+bool TileScheduler::next(int thread, Tile* tile) {
+
+  TileQueue* queue = &queues[thread];
+
+  if (in_order) {
+
+    int index;
+
+    #pragma omp atomic capture
+    index = next_tile++;
+
+    if (index >= (int) tiles.size()) {
+      return false;
+    }
+
+    *tile = tiles[index];
+    queue->tiles_rendered++;
+
+    return true;
+
+  }
+
+  while (true) {
+
+    omp_set_lock(&queue->lock);
+
+    if (queue->front < queue->back) {
+
+      *tile = tiles[queue->front++];
+      omp_unset_lock(&queue->lock);
+
+      queue->tiles_rendered++;
+      return true;
+
+    }
+
+    omp_unset_lock(&queue->lock);
+
+    if (!steal(thread)) {
+      return false;
+    }
+
+  }
+
+}
+
+// Moves the back half of the fullest other queue into thread's empty queue.
+// Returns false if there was nothing left to take.
+bool TileScheduler::steal(int thread) {
+
+  while (true) {
+
+    int victim = -1;
+    int most = 0;
+
+    // Sizes are read without locks, so they are only a hint
+    for (int t = 0; t < thread_count; t++) {
+
+      int remaining = queues[t].back - queues[t].front;
+
+      if (t != thread && remaining > most) {
+        victim = t;
+        most = remaining;
+      }
+
+    }
+
+    if (victim == -1) {
+      return false;
+    }
+
+    omp_set_lock(&queues[victim].lock);
+
+    int remaining = queues[victim].back - queues[victim].front;
+
+    if (remaining <= 0) {
+      // Someone else emptied it first, so look again
+      omp_unset_lock(&queues[victim].lock);
+      continue;
+    }
+
+    int taken = (remaining + 1) / 2;
+    int back = queues[victim].back;
+
+    queues[victim].back -= taken;
+    omp_unset_lock(&queues[victim].lock);
+
+    omp_set_lock(&queues[thread].lock);
+    queues[thread].front = back - taken;
+    queues[thread].back = back;
+    queues[thread].tiles_stolen += taken;
+    omp_unset_lock(&queues[thread].lock);
+
+    return true;
+
+  }
+
+}
+
+// Prints how busy each thread was over the render, to show load balance
+void TileScheduler::report(double render_time) {
+
+  printf("Render time: %fs (%d tiles of %dx%d, %d threads)\n", render_time,
+      (int) tiles.size(), tile_size, tile_size, thread_count);
+
+  for (int t = 0; t < thread_count; t++) {
+    printf("Thread %d: busy %fs (%.1f%%), %d tiles, %d stolen\n", t,
+        queues[t].busy_time, (render_time > 0) ?
+        100 * queues[t].busy_time / render_time : 0,
+        queues[t].tiles_rendered, queues[t].tiles_stolen);
+  }
+
+}
+
+void TileScheduler::dispose() {
+
+  for (int t = 0; t < thread_count; t++) {
+    omp_destroy_lock(&queues[t].lock);
+  }
+
+  free(queues);
+
+}
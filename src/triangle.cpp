@@ -7,7 +7,7 @@
 Triangle::Triangle() {
 
   transform = Matrix::identity_matrix();
-  material = Material();
+  material = 0;
   v1 = Vector(0, 0, 0);
   v2 = Vector(0, 0, 0);
   v3 = Vector(0, 0, 0);
@@ -21,7 +21,7 @@ Triangle::Triangle() {
 }
 
 Triangle::Triangle(Matrix trans, Vector point1, Vector point2, Vector point3, 
-    Vector norm, Material mat) {
+    Vector norm, unsigned short mat) {
 
   transform = trans;
   material = mat;
@@ -38,7 +38,7 @@ Triangle::Triangle(Matrix trans, Vector point1, Vector point2, Vector point3,
 
 Triangle::Triangle(Matrix trans, Vector point1, Vector point2, Vector point3, 
     Vector norm1, Vector norm2, Vector norm3, Vector tc1, Vector tc2,
-    Vector tc3, Material mat) {
+    Vector tc3, unsigned short mat) {
 
   transform = trans;
   material = mat;
@@ -55,27 +55,16 @@ Triangle::Triangle(Matrix trans, Vector point1, Vector point2, Vector point3,
 
 }
 
-Vector Triangle::get_normal(Vector point) {
+// Smooth normal blended from the normals at the three corners, using the
+// barycentric coordinates the intersection test already found
+Vector Triangle::interpolate_normal(float beta, float gamma, 
+    const Vector& vnorm1, const Vector& vnorm2, const Vector& vnorm3) {
 
   Vector U = vnorm2 - vnorm1;
   Vector V = vnorm3 - vnorm1;
 
-  // x = x1 + beta * (x2 - x1) + gamma * (x3 - x1)
-  // beta * (x2 - x1) = x - x1 - gamma * (x3 - x1)
-  // beta = [(x - x1) + gamma * (x1 - x3)] / (x2 - x1)
-  // y = y1 + beta * (y2 - y1) + gamma * (y3 - y1)
-  // y - y1 = [(x - x1) + gamma * (x1 - x3)] / (x2 - x1) + gamma * (y3 - y1)
-  // gamma * [(x1 - x3) / (x2 - x1) + (y3 - y1)] = (y - y1) - (x1 - x) / (x2 - x1)
-  // gamma * [(x1 - x3) + (y3 - y1) * (x2 - x1)] = (y - y1) * (x2 - x1) - (x1 -x)
-
-  float gamma = (v1.x - v3.x) + (v3.y - v1.y) * (v2.x - v1.x);
-  if (gamma != 0)
-    gamma = ((point.y - v1.y) * (v2.x - v1.x) + (point.x - v1.x)) / gamma;
-  float beta = (point.x - v1.x) + gamma * (v1.x - v3.x);
-  if (v2.x - v1.x != 0)
-    beta = beta / (v2.x - v1.x);
-
-  Vector normal = vnorm1 + beta * U + gamma * V;
+  // n = (1 - beta - gamma) * n1 + beta * n2 + gamma * n3
+  Vector normal = vnorm1 + U * beta + V * gamma;
 
   return normal.normalize();
 
@@ -103,75 +92,108 @@ void Triangle::do_transform(Matrix c_transform) {
   
 }
 
-bool Triangle::intersect(Ray ray){
+int Triangle::primitive_count() {
 
-  Vector pos = ray.position;
-  Vector dir = ray.direction;
+  return 1;
 
-  float min = ray.t_min;
-  float max = ray.t_max;
+}
 
-  // the actual thing
-  Vector e1 = v2-v1;
-  Vector e2 = v3-v1;
-  Vector p = Vector::cross(dir, e2);
-  float a = Vector::dot(p, e1);
+BoundingBox Triangle::primitive_bbox(int index) {
 
-  if(a > -0.00001 && a < 0.00001) return false;
+  return bbox;
 
-  float f = 1/a;
+}
 
-  Vector s = pos-v1;
-  float beta = f * Vector::dot(s, p);
+bool Triangle::intersect(const Ray& ray, int index, HitRecord& hit) {
 
-  if(beta < 0 || beta > 1.0) return false;
+  if (!intersect_face(ray, v1, v2, v3, hit)) {
+    return false;
+  }
 
-  Vector q = Vector::cross(s, e1);
-  float gamma = f * Vector::dot(dir, q);
+  fill_hit(ray, index, hit);
 
-  if(gamma < 0.0 || beta + gamma > 1.0) return false;
+  return true;
 
-  float t = f * Vector::dot(e2, q);
+}
 
-  if(t < min || t > max) return false;
+void Triangle::fill_hit(const Ray& ray, int index, HitRecord& hit) {
 
-  return true;
+  fill_face(ray, v1, v2, v3, vnorm1, vnorm2, vnorm3, tcoord1, tcoord2, 
+      tcoord3, hit);
 
 }
 
-Vector Triangle::intersectP(Ray ray) {
+bool Triangle::get_triangle(int index, Vector* corner1, Vector* corner2, 
+    Vector* corner3) {
 
-  Vector pos = ray.position;
-  Vector dir = ray.direction;
+  *corner1 = v1;
+  *corner2 = v2;
+  *corner3 = v3;
 
-  float min = ray.t_min;
-  float max = ray.t_max;
+  return true;
 
-  float t = intersectT(ray);
+}
 
-  if (t >= min && t <= max) {
-    return pos + (t * dir);
-  } else {
-    return Vector(numeric_limits<float>::infinity(), 
-        numeric_limits<float>::infinity(), numeric_limits<float>::infinity());
-  }
+bool Triangle::occludes(const Ray& ray, int index) {
+
+  HitRecord hit;
+
+  return intersect_face(ray, v1, v2, v3, hit);
 
 }
 
-float Triangle::intersectT(Ray ray) {
+// Moller-Trumbore test that keeps t and the barycentric coordinates
+bool Triangle::intersect_face(const Ray& ray, const Vector& v1, 
+    const Vector& v2, const Vector& v3, HitRecord& hit) {
 
   Vector pos = ray.position;
   Vector dir = ray.direction;
 
   Vector e1 = v2 - v1;
   Vector e2 = v3 - v1;
+  Vector p = Vector::cross(dir, e2);
+  float a = Vector::dot(p, e1);
+
+  if (a > -0.00001 && a < 0.00001) return false;
+
+  float f = 1 / a;
 
   Vector s = pos - v1;
-  Vector p = Vector::cross(dir, e2);
+  float beta = f * Vector::dot(s, p);
+
+  if (beta < 0 || beta > 1.0) return false;
+
   Vector q = Vector::cross(s, e1);
+  float gamma = f * Vector::dot(dir, q);
 
-  float a = Vector::dot(p, e1);
+  if (gamma < 0.0 || beta + gamma > 1.0) return false;
 
-  return (1 / a) * (Vector::dot(e2, q));
+  float t = f * Vector::dot(e2, q);
+
+  if (t < ray.t_min || t > ray.t_max) return false;
+
+  hit.t = t;
+  hit.beta = beta;
+  hit.gamma = gamma;
 
-}
\ No newline at end of file
+  return true;
+
+}
+
+// Fills in the point, normals and texture coordinates of a hit found by
+// intersect_face
+void Triangle::fill_face(const Ray& ray, const Vector& v1, const Vector& v2,
+    const Vector& v3, const Vector& vnorm1, const Vector& vnorm2, 
+    const Vector& vnorm3, const Vector& tcoord1, const Vector& tcoord2, 
+    const Vector& tcoord3, HitRecord& hit) {
+
+  float alpha = 1 - hit.beta - hit.gamma;
+
+  hit.point = ray.position + ray.direction * hit.t;
+  hit.normal = Vector::cross(v2 - v1, v3 - v1).normalize();
+  hit.shading_normal = interpolate_normal(hit.beta, hit.gamma, vnorm1, vnorm2,
+      vnorm3);
+  hit.u = alpha * tcoord1.x + hit.beta * tcoord2.x + hit.gamma * tcoord3.x;
+  hit.v = alpha * tcoord1.y + hit.beta * tcoord2.y + hit.gamma * tcoord3.y;
+
+}
@@ -0,0 +1,529 @@
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+#include "triangleblocks.h"
+
+#ifndef TRIANGLE_H
+#include "triangle.h"
+#endif
+
+using namespace std;
+
+//*****************************************************************************
+// Triangle kernels
+//*****************************************************************************
+
+// The kernels repeat Triangle::intersect_face operation for operation, without
+// fused multiply-adds, so every lane gets exactly the t, beta and gamma the
+// scalar test would. A lane is rejected by the same ordered comparisons, which
+// let NaNs through just as the scalar code does. Determinants within 0.00001
+// (a double) of zero are the floats within 1e-5f of it, inclusive.
+
+// Tests four triangles whose rows are stride floats apart. Returns a bit mask
+// of the lanes the ray hits within [t_min, t_max].
+static int intersect_triangles4(const float* block, int stride,
+    const Ray& ray, float* t_out, float* beta_out, float* gamma_out) {
+
+#if defined(__SSE__)
+
+  __m128 dx = _mm_set1_ps(ray.direction.x);
+  __m128 dy = _mm_set1_ps(ray.direction.y);
+  __m128 dz = _mm_set1_ps(ray.direction.z);
+
+  __m128 e1x = _mm_load_ps(block + 3 * stride);
+  __m128 e1y = _mm_load_ps(block + 4 * stride);
+  __m128 e1z = _mm_load_ps(block + 5 * stride);
+  __m128 e2x = _mm_load_ps(block + 6 * stride);
+  __m128 e2y = _mm_load_ps(block + 7 * stride);
+  __m128 e2z = _mm_load_ps(block + 8 * stride);
+
+  __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+  __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+  __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+
+  __m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, e1x), _mm_mul_ps(py, e1y)),
+      _mm_mul_ps(pz, e1z));
+  __m128 f = _mm_div_ps(_mm_set1_ps(1.0f), a);
+
+  __m128 sx = _mm_sub_ps(_mm_set1_ps(ray.position.x), _mm_load_ps(block));
+  __m128 sy = _mm_sub_ps(_mm_set1_ps(ray.position.y),
+      _mm_load_ps(block + stride));
+  __m128 sz = _mm_sub_ps(_mm_set1_ps(ray.position.z),
+      _mm_load_ps(block + 2 * stride));
+
+  __m128 beta = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px),
+      _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)));
+
+  __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+  __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+  __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+
+  __m128 gamma = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx),
+      _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)));
+  __m128 t = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx),
+      _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)));
+
+  __m128 zero = _mm_setzero_ps();
+  __m128 one = _mm_set1_ps(1.0f);
+
+  __m128 reject = _mm_and_ps(_mm_cmpge_ps(a, _mm_set1_ps(-1e-5f)),
+      _mm_cmple_ps(a, _mm_set1_ps(1e-5f)));
+  reject = _mm_or_ps(reject, _mm_or_ps(_mm_cmplt_ps(beta, zero),
+      _mm_cmpgt_ps(beta, one)));
+  reject = _mm_or_ps(reject, _mm_or_ps(_mm_cmplt_ps(gamma, zero),
+      _mm_cmpgt_ps(_mm_add_ps(beta, gamma), one)));
+  reject = _mm_or_ps(reject, _mm_or_ps(
+      _mm_cmplt_ps(t, _mm_set1_ps(ray.t_min)),
+      _mm_cmpgt_ps(t, _mm_set1_ps(ray.t_max))));
+
+  _mm_storeu_ps(t_out, t);
+  _mm_storeu_ps(beta_out, beta);
+  _mm_storeu_ps(gamma_out, gamma);
+
+  return ~_mm_movemask_ps(reject) & 0xf;
+
+#else
+
+  int mask = 0;
+
+  for (int lane = 0; lane < 4; lane++) {
+
+    Vector v1(block[lane], block[stride + lane], block[2 * stride + lane]);
+    Vector v2 = v1 + Vector(block[3 * stride + lane],
+        block[4 * stride + lane], block[5 * stride + lane]);
+    Vector v3 = v1 + Vector(block[6 * stride + lane],
+        block[7 * stride + lane], block[8 * stride + lane]);
+
+    HitRecord hit;
+
+    if (Triangle::intersect_face(ray, v1, v2, v3, hit)) {
+      t_out[lane] = hit.t;
+      beta_out[lane] = hit.beta;
+      gamma_out[lane] = hit.gamma;
+      mask |= 1 << lane;
+    }
+
+  }
+
+  return mask;
+
+#endif
+
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#define TRIANGLE_HAS_AVX2
+
+// Same test as intersect_triangles4, for all eight lanes of a width 8 block
+__attribute__((target("avx2")))
+static int intersect_triangles8(const float* block, const Ray& ray,
+    float* t_out, float* beta_out, float* gamma_out) {
+
+  __m256 dx = _mm256_set1_ps(ray.direction.x);
+  __m256 dy = _mm256_set1_ps(ray.direction.y);
+  __m256 dz = _mm256_set1_ps(ray.direction.z);
+
+  __m256 e1x = _mm256_load_ps(block + 3 * 8);
+  __m256 e1y = _mm256_load_ps(block + 4 * 8);
+  __m256 e1z = _mm256_load_ps(block + 5 * 8);
+  __m256 e2x = _mm256_load_ps(block + 6 * 8);
+  __m256 e2y = _mm256_load_ps(block + 7 * 8);
+  __m256 e2z = _mm256_load_ps(block + 8 * 8);
+
+  __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+  __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+  __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+
+  __m256 a = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px, e1x),
+      _mm256_mul_ps(py, e1y)), _mm256_mul_ps(pz, e1z));
+  __m256 f = _mm256_div_ps(_mm256_set1_ps(1.0f), a);
+
+  __m256 sx = _mm256_sub_ps(_mm256_set1_ps(ray.position.x),
+      _mm256_load_ps(block));
+  __m256 sy = _mm256_sub_ps(_mm256_set1_ps(ray.position.y),
+      _mm256_load_ps(block + 8));
+  __m256 sz = _mm256_sub_ps(_mm256_set1_ps(ray.position.z),
+      _mm256_load_ps(block + 2 * 8));
+
+  __m256 beta = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(
+      _mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)), _mm256_mul_ps(sz, pz)));
+
+  __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+  __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+  __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+
+  __m256 gamma = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(
+      _mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)));
+  __m256 t = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(
+      _mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)),
+      _mm256_mul_ps(e2z, qz)));
+
+  __m256 zero = _mm256_setzero_ps();
+  __m256 one = _mm256_set1_ps(1.0f);
+
+  __m256 reject = _mm256_and_ps(
+      _mm256_cmp_ps(a, _mm256_set1_ps(-1e-5f), _CMP_GE_OQ),
+      _mm256_cmp_ps(a, _mm256_set1_ps(1e-5f), _CMP_LE_OQ));
+  reject = _mm256_or_ps(reject, _mm256_or_ps(
+      _mm256_cmp_ps(beta, zero, _CMP_LT_OQ),
+      _mm256_cmp_ps(beta, one, _CMP_GT_OQ)));
+  reject = _mm256_or_ps(reject, _mm256_or_ps(
+      _mm256_cmp_ps(gamma, zero, _CMP_LT_OQ),
+      _mm256_cmp_ps(_mm256_add_ps(beta, gamma), one, _CMP_GT_OQ)));
+  reject = _mm256_or_ps(reject, _mm256_or_ps(
+      _mm256_cmp_ps(t, _mm256_set1_ps(ray.t_min), _CMP_LT_OQ),
+      _mm256_cmp_ps(t, _mm256_set1_ps(ray.t_max), _CMP_GT_OQ)));
+
+  _mm256_storeu_ps(t_out, t);
+  _mm256_storeu_ps(beta_out, beta);
+  _mm256_storeu_ps(gamma_out, gamma);
+
+  return ~_mm256_movemask_ps(reject) & 0xff;
+
+}
+
+#endif
+
+//*****************************************************************************
+// TriangleBlocks
+//*****************************************************************************
+
+TriangleBlocks::TriangleBlocks(BoundingTree* tree, int block_width) {
+
+  width = block_width;
+  block_count = 0;
+  prims = &tree->ordered_prims;
+
+  int count = prims->size();
+
+  leaf_blocks = (int*) malloc(max(count, 1) * sizeof(int));
+
+  for (int i = 0; i < count; i++) {
+    leaf_blocks[i] = -1;
+  }
+
+  // Spliced meshes bring their blocks along, after one another
+  vector<char> spliced(count, 0);
+  vector<int> first_blocks(tree->subtrees.size());
+
+  for (unsigned int s = 0; s < tree->subtrees.size(); s++) {
+
+    TriangleBlocks* mesh_blocks = tree->subtrees[s]->blocks;
+    int first = tree->subtree_offsets[s];
+    int faces = tree->subtrees[s]->ordered_prims.size();
+
+    first_blocks[s] = block_count;
+
+    for (int i = 0; i < faces; i++) {
+
+      spliced[first + i] = 1;
+
+      if (mesh_blocks->leaf_blocks[i] >= 0) {
+        leaf_blocks[first + i] = mesh_blocks->leaf_blocks[i] + block_count;
+      }
+
+    }
+
+    block_count += mesh_blocks->block_count;
+
+  }
+
+  // Find the other leaves that are all triangles, and give each its blocks
+  for (int n = 0; n < tree->node_count; n++) {
+
+    LinearNode* node = &tree->nodes[n];
+    bool triangles = node->shape_count > 0 && !spliced[node->offset];
+
+    for (int i = node->offset; triangles &&
+        i < node->offset + node->shape_count; i++) {
+
+      Vector v1, v2, v3;
+      Primitive* prim = &(*prims)[i];
+
+      triangles = prim->shape->get_triangle(prim->index, &v1, &v2, &v3);
+
+    }
+
+    if (triangles) {
+      leaf_blocks[node->offset] = block_count;
+      block_count += (node->shape_count + width - 1) / width;
+    }
+
+  }
+
+  allocate_blocks();
+
+  for (unsigned int s = 0; s < tree->subtrees.size(); s++) {
+
+    TriangleBlocks* mesh_blocks = tree->subtrees[s]->blocks;
+    int lane_count = mesh_blocks->block_count * width;
+
+    memcpy(data + first_blocks[s] * TRIANGLE_BLOCK_ROWS * width,
+        mesh_blocks->data, mesh_blocks->block_count * TRIANGLE_BLOCK_ROWS *
+        width * sizeof(float));
+
+    for (int l = 0; l < lane_count; l++) {
+      if (mesh_blocks->lanes[l] >= 0) {
+        lanes[first_blocks[s] * width + l] = mesh_blocks->lanes[l] +
+            tree->subtree_offsets[s];
+      }
+    }
+
+  }
+
+  for (int n = 0; n < tree->node_count; n++) {
+
+    LinearNode* node = &tree->nodes[n];
+
+    if (node->shape_count == 0 || spliced[node->offset] ||
+        leaf_blocks[node->offset] < 0) {
+      continue;
+    }
+
+    for (int k = 0; k < node->shape_count; k++) {
+
+      int i = node->offset + k;
+      int lane = leaf_blocks[node->offset] * width + k;
+      float* block = data + (lane / width) * TRIANGLE_BLOCK_ROWS * width;
+      int l = lane % width;
+
+      Vector v1, v2, v3;
+      Primitive* prim = &(*prims)[i];
+
+      prim->shape->get_triangle(prim->index, &v1, &v2, &v3);
+
+      Vector e1 = v2 - v1;
+      Vector e2 = v3 - v1;
+
+      block[0 * width + l] = v1.x;
+      block[1 * width + l] = v1.y;
+      block[2 * width + l] = v1.z;
+      block[3 * width + l] = e1.x;
+      block[4 * width + l] = e1.y;
+      block[5 * width + l] = e1.z;
+      block[6 * width + l] = e2.x;
+      block[7 * width + l] = e2.y;
+      block[8 * width + l] = e2.z;
+
+      lanes[lane] = i;
+
+    }
+
+  }
+
+}
+
+// Empty blocks over primitives, for a cache to fill in. No leaf has any yet.
+TriangleBlocks::TriangleBlocks(vector<Primitive>* primitives, int block_width,
+    int blocks) {
+
+  width = block_width;
+  block_count = blocks;
+  prims = primitives;
+
+  int count = prims->size();
+
+  leaf_blocks = (int*) malloc(max(count, 1) * sizeof(int));
+
+  for (int i = 0; i < count; i++) {
+    leaf_blocks[i] = -1;
+  }
+
+  allocate_blocks();
+
+}
+
+// Allocates block_count blocks with every lane empty
+void TriangleBlocks::allocate_blocks() {
+
+  data = NULL;
+  lanes = (int*) malloc(max(block_count * width, 1) * sizeof(int));
+
+  if (posix_memalign((void**) &data, 32, max(block_count, 1) *
+      TRIANGLE_BLOCK_ROWS * width * sizeof(float))) {
+    fprintf(stderr, "Could not allocate %d triangle blocks\n", block_count);
+    exit(EXIT_FAILURE);
+  }
+
+  // Empty lanes have zero edges, which no ray can hit
+  memset(data, 0, max(block_count, 1) * TRIANGLE_BLOCK_ROWS * width *
+      sizeof(float));
+
+  for (int i = 0; i < block_count * width; i++) {
+    lanes[i] = -1;
+  }
+
+}
+
+// Tests the ray against every lane of block at once
+int TriangleBlocks::intersect_block(int block, const Ray& ray, float* t,
+    float* beta, float* gamma) {
+
+  float* block_data = data + block * TRIANGLE_BLOCK_ROWS * width;
+
+  if (width == 4) {
+    return intersect_triangles4(block_data, 4, ray, t, beta, gamma);
+  }
+
+#ifdef TRIANGLE_HAS_AVX2
+  static bool avx2 = __builtin_cpu_supports("avx2");
+
+  if (avx2) {
+    return intersect_triangles8(block_data, ray, t, beta, gamma);
+  }
+#endif
+
+  return intersect_triangles4(block_data, 8, ray, t, beta, gamma) |
+      (intersect_triangles4(block_data + 4, 8, ray, t + 4, beta + 4,
+      gamma + 4) << 4);
+
+}
+
+// Closest hit among the primitives [first, first + count) of one leaf.
+// ray.t_max shrinks to the hit, as it would after the shapes' own tests, and
+// only the winning lane of a packed leaf is completed with fill_hit.
+bool TriangleBlocks::intersect_leaf(int first, int count, Ray& ray,
+    Primitive skip, HitRecord* hit) {
+
+  int block = leaf_blocks[first];
+  bool found = false;
+
+  if (block < 0) {
+
+    HitRecord candidate;
+
+    for (int i = first; i < first + count; i++) {
+
+      Primitive* prim = &(*prims)[i];
+
+      // You can't hit yourself
+      if (prim->is(skip.shape, skip.index) ||
+          !prim->shape->intersect(ray, prim->index, candidate)) {
+        continue;
+      }
+
+      *hit = candidate;
+      hit->shape = prim->shape;
+      hit->index = prim->index;
+      ray.t_max = candidate.t;
+      found = true;
+
+    }
+
+    return found;
+
+  }
+
+  float t[TRIANGLE_MAX_WIDTH];
+  float beta[TRIANGLE_MAX_WIDTH];
+  float gamma[TRIANGLE_MAX_WIDTH];
+  int best = -1;
+  float best_beta = 0;
+  float best_gamma = 0;
+
+  for (int b = 0; b * width < count; b++) {
+
+    int mask = intersect_block(block + b, ray, t, beta, gamma);
+
+    // Lanes in order, each against the t_max left by the ones before, so
+    // ties go to the same primitive as in the scalar loop
+    for (int l = 0; mask && l < width; l++) {
+
+      if (!(mask & (1 << l)) || t[l] > ray.t_max) {
+        continue;
+      }
+
+      int i = lanes[(block + b) * width + l];
+
+      if ((*prims)[i].is(skip.shape, skip.index)) {
+        continue;
+      }
+
+      best = i;
+      best_beta = beta[l];
+      best_gamma = gamma[l];
+      ray.t_max = t[l];
+
+    }
+
+  }
+
+  if (best < 0) {
+    return false;
+  }
+
+  Primitive* prim = &(*prims)[best];
+
+  hit->t = ray.t_max;
+  hit->beta = best_beta;
+  hit->gamma = best_gamma;
+  prim->shape->fill_hit(ray, prim->index, *hit);
+  hit->shape = prim->shape;
+  hit->index = prim->index;
+
+  return true;
+
+}
+
+// Whether anything in the leaf blocks the ray, for shadow rays
+bool TriangleBlocks::occluded_leaf(int first, int count, const Ray& ray,
+    Primitive skip) {
+
+  int block = leaf_blocks[first];
+
+  if (block < 0) {
+
+    for (int i = first; i < first + count; i++) {
+
+      Primitive* prim = &(*prims)[i];
+
+      // You can't shadow yourself
+      if (!prim->is(skip.shape, skip.index) &&
+          prim->shape->occludes(ray, prim->index)) {
+        return true;
+      }
+
+    }
+
+    return false;
+
+  }
+
+  float t[TRIANGLE_MAX_WIDTH];
+  float beta[TRIANGLE_MAX_WIDTH];
+  float gamma[TRIANGLE_MAX_WIDTH];
+
+  for (int b = 0; b * width < count; b++) {
+
+    int mask = intersect_block(block + b, ray, t, beta, gamma);
+
+    for (int l = 0; mask && l < width; l++) {
+      if ((mask & (1 << l)) &&
+          !(*prims)[lanes[(block + b) * width + l]].is(skip.shape,
+          skip.index)) {
+        return true;
+      }
+    }
+
+  }
+
+  return false;
+
+}
+
+void TriangleBlocks::dispose() {
+
+  free(data);
+  free(lanes);
+  free(leaf_blocks);
+
+  delete this;
+
+}
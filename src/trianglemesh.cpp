@@ -0,0 +1,196 @@
+#include <algorithm>
+
+#include "trianglemesh.h"
+
+//*****************************************************************************
+// TriangleMesh
+//*****************************************************************************
+
+TriangleMesh::TriangleMesh() {
+
+  transform = Matrix::identity_matrix();
+  material = 0;
+  tree = NULL;
+  bbox.reset();
+
+}
+
+TriangleMesh::TriangleMesh(Matrix trans, unsigned short mat) {
+
+  transform = trans;
+  material = mat;
+  tree = NULL;
+  bbox.reset();
+
+}
+
+void TriangleMesh::add_vertex(Vector vertex) {
+
+  vertices.push_back(Matrix::transform(transform, vertex));
+
+}
+
+void TriangleMesh::add_normal(Vector normal) {
+
+  normals.push_back(normal.normalize());
+
+}
+
+void TriangleMesh::add_tcoord(Vector tcoord) {
+
+  tcoords.push_back(tcoord);
+
+}
+
+// Adds a face from .obj indices. Returns false, leaving the mesh unchanged,
+// if any index refers to something that has not been read yet.
+bool TriangleMesh::add_face(int* vertnum, int* vnormnum, int* tcoordnum,
+    Vector camera_origin) {
+
+  for (int i = 0; i < 3; i++) {
+    if (vertnum[i] < 0 || vertnum[i] >= (int) vertices.size() ||
+        vnormnum[i] < 0 || vnormnum[i] >= (int) normals.size() ||
+        tcoordnum[i] < 0 || tcoordnum[i] >= (int) tcoords.size()) {
+      return false;
+    }
+  }
+
+  int order[3] = {0, 1, 2};
+
+  if (vnormnum[0] == 0 && vnormnum[1] == 0 && vnormnum[2] == 0) {
+
+    // Without normals, wind the face so that it faces the camera
+    Vector point1 = vertices[vertnum[0]];
+    Vector point2 = vertices[vertnum[1]];
+    Vector point3 = vertices[vertnum[2]];
+    Vector normal = Vector::cross(point2 - point1, point3 - point1);
+    Vector view = (point1 + point2 + point3) / 3 - camera_origin;
+
+    if (Vector::dot(normal, view) > 0) {
+      order[1] = 2;
+      order[2] = 1;
+    }
+
+  }
+
+  for (int i = 0; i < 3; i++) {
+    vertex_indices.push_back(vertnum[order[i]]);
+    normal_indices.push_back(vnormnum[order[i]]);
+    tcoord_indices.push_back(tcoordnum[order[i]]);
+  }
+
+  BoundingBox face_bbox = primitive_bbox(face_count() - 1);
+  bbox.expand(&face_bbox);
+
+  return true;
+
+}
+
+int TriangleMesh::face_count() {
+
+  return vertex_indices.size() / 3;
+
+}
+
+bool TriangleMesh::flat_face(int index) {
+
+  return normal_indices[3 * index] == 0 && 
+      normal_indices[3 * index + 1] == 0 && normal_indices[3 * index + 2] == 0;
+
+}
+
+void TriangleMesh::compute_bounding_box() {
+
+  bbox.reset();
+
+  for (int i = 0; i < face_count(); i++) {
+    BoundingBox face_bbox = primitive_bbox(i);
+    bbox.expand(&face_bbox);
+  }
+
+}
+
+int TriangleMesh::primitive_count() {
+
+  return face_count();
+
+}
+
+BoundingBox TriangleMesh::primitive_bbox(int index) {
+
+  Vector v1 = vertices[vertex_indices[3 * index]];
+  Vector v2 = vertices[vertex_indices[3 * index + 1]];
+  Vector v3 = vertices[vertex_indices[3 * index + 2]];
+
+  BoundingBox face_bbox;
+
+  face_bbox.x_min = min(min(v1.x, v2.x), v3.x);
+  face_bbox.x_max = max(max(v1.x, v2.x), v3.x);
+  face_bbox.y_min = min(min(v1.y, v2.y), v3.y);
+  face_bbox.y_max = max(max(v1.y, v2.y), v3.y);
+  face_bbox.z_min = min(min(v1.z, v2.z), v3.z);
+  face_bbox.z_max = max(max(v1.z, v2.z), v3.z);
+
+  return face_bbox;
+
+}
+
+bool TriangleMesh::intersect(const Ray& ray, int index, HitRecord& hit) {
+
+  const Vector& v1 = vertices[vertex_indices[3 * index]];
+  const Vector& v2 = vertices[vertex_indices[3 * index + 1]];
+  const Vector& v3 = vertices[vertex_indices[3 * index + 2]];
+
+  if (!Triangle::intersect_face(ray, v1, v2, v3, hit)) {
+    return false;
+  }
+
+  fill_hit(ray, index, hit);
+
+  return true;
+
+}
+
+void TriangleMesh::fill_hit(const Ray& ray, int index, HitRecord& hit) {
+
+  const Vector& v1 = vertices[vertex_indices[3 * index]];
+  const Vector& v2 = vertices[vertex_indices[3 * index + 1]];
+  const Vector& v3 = vertices[vertex_indices[3 * index + 2]];
+
+  const Vector& tcoord1 = tcoords[tcoord_indices[3 * index]];
+  const Vector& tcoord2 = tcoords[tcoord_indices[3 * index + 1]];
+  const Vector& tcoord3 = tcoords[tcoord_indices[3 * index + 2]];
+
+  if (flat_face(index)) {
+    Vector normal = Vector::cross(v2 - v1, v3 - v1).normalize();
+    Triangle::fill_face(ray, v1, v2, v3, normal, normal, normal, tcoord1, 
+        tcoord2, tcoord3, hit);
+  } else {
+    Triangle::fill_face(ray, v1, v2, v3, normals[normal_indices[3 * index]],
+        normals[normal_indices[3 * index + 1]], 
+        normals[normal_indices[3 * index + 2]], tcoord1, tcoord2, tcoord3, 
+        hit);
+  }
+
+}
+
+bool TriangleMesh::occludes(const Ray& ray, int index) {
+
+  HitRecord hit;
+
+  return Triangle::intersect_face(ray, vertices[vertex_indices[3 * index]],
+      vertices[vertex_indices[3 * index + 1]], 
+      vertices[vertex_indices[3 * index + 2]], hit);
+
+}
+
+bool TriangleMesh::get_triangle(int index, Vector* v1, Vector* v2, 
+    Vector* v3) {
+
+  *v1 = vertices[vertex_indices[3 * index]];
+  *v2 = vertices[vertex_indices[3 * index + 1]];
+  *v3 = vertices[vertex_indices[3 * index + 2]];
+
+  return true;
+
+}
@@ -4,11 +4,11 @@
 // Vector
 //****************************************************
 
-float Vector::len() {
+float Vector::len() const {
   return sqrt(x * x + y * y + z * z);
 }
 
-Vector Vector::normalize() {
+Vector Vector::normalize() const {
 
   float length = len();
 
@@ -125,7 +125,7 @@ Vector operator*(Vector lhs, const float scalar) {
   return lhs *= scalar;
 }
 
-Vector operator*(const float scalar, Vector& rhs) {
+Vector operator*(const float scalar, const Vector& rhs) {
   Vector result = Vector(rhs.x, rhs.y, rhs.z);
   return result *= scalar;
 }
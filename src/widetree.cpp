@@ -0,0 +1,462 @@
+#include <algorithm>
+#include <limits>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+#include "widetree.h"
+
+using namespace std;
+
+//*****************************************************************************
+// Box kernels
+//*****************************************************************************
+
+// Slab-tests four children whose rows are stride floats apart. Returns a bit
+// mask of the lanes the ray enters within [t_min, t_max].
+static int intersect_lanes4(const float* node_bounds, int stride,
+    WideRay* ray, float* t_near) {
+
+#if defined(__SSE__)
+
+  __m128 tx_near = _mm_mul_ps(_mm_sub_ps(
+      _mm_load_ps(node_bounds + ray->near_row[0] * stride),
+      _mm_set1_ps(ray->origin[0])), _mm_set1_ps(ray->inv_direction[0]));
+  __m128 tx_far = _mm_mul_ps(_mm_sub_ps(
+      _mm_load_ps(node_bounds + ray->far_row[0] * stride),
+      _mm_set1_ps(ray->origin[0])), _mm_set1_ps(ray->inv_direction[0]));
+  __m128 ty_near = _mm_mul_ps(_mm_sub_ps(
+      _mm_load_ps(node_bounds + ray->near_row[1] * stride),
+      _mm_set1_ps(ray->origin[1])), _mm_set1_ps(ray->inv_direction[1]));
+  __m128 ty_far = _mm_mul_ps(_mm_sub_ps(
+      _mm_load_ps(node_bounds + ray->far_row[1] * stride),
+      _mm_set1_ps(ray->origin[1])), _mm_set1_ps(ray->inv_direction[1]));
+  __m128 tz_near = _mm_mul_ps(_mm_sub_ps(
+      _mm_load_ps(node_bounds + ray->near_row[2] * stride),
+      _mm_set1_ps(ray->origin[2])), _mm_set1_ps(ray->inv_direction[2]));
+  __m128 tz_far = _mm_mul_ps(_mm_sub_ps(
+      _mm_load_ps(node_bounds + ray->far_row[2] * stride),
+      _mm_set1_ps(ray->origin[2])), _mm_set1_ps(ray->inv_direction[2]));
+
+  __m128 near = _mm_max_ps(_mm_max_ps(tx_near, ty_near),
+      _mm_max_ps(tz_near, _mm_set1_ps(ray->t_min)));
+  __m128 far = _mm_min_ps(_mm_min_ps(tx_far, ty_far),
+      _mm_min_ps(tz_far, _mm_set1_ps(ray->t_max)));
+
+  _mm_storeu_ps(t_near, near);
+
+  return _mm_movemask_ps(_mm_cmple_ps(near, far));
+
+#else
+
+  int mask = 0;
+
+  for (int lane = 0; lane < 4; lane++) {
+
+    float near = ray->t_min;
+    float far = ray->t_max;
+
+    for (int axis = 0; axis < 3; axis++) {
+      float t0 = (node_bounds[ray->near_row[axis] * stride + lane] -
+          ray->origin[axis]) * ray->inv_direction[axis];
+      float t1 = (node_bounds[ray->far_row[axis] * stride + lane] -
+          ray->origin[axis]) * ray->inv_direction[axis];
+      near = max(near, t0);
+      far = min(far, t1);
+    }
+
+    t_near[lane] = near;
+
+    if (near <= far) {
+      mask |= 1 << lane;
+    }
+
+  }
+
+  return mask;
+
+#endif
+
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#define WIDE_HAS_AVX2
+
+// Same test as intersect_lanes4, for all eight lanes of a width 8 node
+__attribute__((target("avx2")))
+static int intersect_lanes8(const float* node_bounds, WideRay* ray,
+    float* t_near) {
+
+  __m256 tx_near = _mm256_mul_ps(_mm256_sub_ps(
+      _mm256_load_ps(node_bounds + ray->near_row[0] * 8),
+      _mm256_set1_ps(ray->origin[0])), _mm256_set1_ps(ray->inv_direction[0]));
+  __m256 tx_far = _mm256_mul_ps(_mm256_sub_ps(
+      _mm256_load_ps(node_bounds + ray->far_row[0] * 8),
+      _mm256_set1_ps(ray->origin[0])), _mm256_set1_ps(ray->inv_direction[0]));
+  __m256 ty_near = _mm256_mul_ps(_mm256_sub_ps(
+      _mm256_load_ps(node_bounds + ray->near_row[1] * 8),
+      _mm256_set1_ps(ray->origin[1])), _mm256_set1_ps(ray->inv_direction[1]));
+  __m256 ty_far = _mm256_mul_ps(_mm256_sub_ps(
+      _mm256_load_ps(node_bounds + ray->far_row[1] * 8),
+      _mm256_set1_ps(ray->origin[1])), _mm256_set1_ps(ray->inv_direction[1]));
+  __m256 tz_near = _mm256_mul_ps(_mm256_sub_ps(
+      _mm256_load_ps(node_bounds + ray->near_row[2] * 8),
+      _mm256_set1_ps(ray->origin[2])), _mm256_set1_ps(ray->inv_direction[2]));
+  __m256 tz_far = _mm256_mul_ps(_mm256_sub_ps(
+      _mm256_load_ps(node_bounds + ray->far_row[2] * 8),
+      _mm256_set1_ps(ray->origin[2])), _mm256_set1_ps(ray->inv_direction[2]));
+
+  __m256 near = _mm256_max_ps(_mm256_max_ps(tx_near, ty_near),
+      _mm256_max_ps(tz_near, _mm256_set1_ps(ray->t_min)));
+  __m256 far = _mm256_min_ps(_mm256_min_ps(tx_far, ty_far),
+      _mm256_min_ps(tz_far, _mm256_set1_ps(ray->t_max)));
+
+  _mm256_storeu_ps(t_near, near);
+
+  return _mm256_movemask_ps(_mm256_cmp_ps(near, far, _CMP_LE_OQ));
+
+}
+
+#endif
+
+//*****************************************************************************
+// WideRay
+//*****************************************************************************
+
+WideRay::WideRay(const Ray& ray) {
+
+  origin[0] = ray.position.x;
+  origin[1] = ray.position.y;
+  origin[2] = ray.position.z;
+
+  // The ray already keeps its inverse direction finite
+  inv_direction[0] = ray.inv_direction.x;
+  inv_direction[1] = ray.inv_direction.y;
+  inv_direction[2] = ray.inv_direction.z;
+
+  for (int axis = 0; axis < 3; axis++) {
+    near_row[axis] = 2 * axis + ray.sign[axis];
+    far_row[axis] = 2 * axis + 1 - ray.sign[axis];
+  }
+
+  t_min = ray.t_min;
+  t_max = ray.t_max;
+
+}
+
+//*****************************************************************************
+// WideTree
+//*****************************************************************************
+
+WideTree::WideTree(BoundingTree* tree, int tree_width) {
+
+  width = tree_width;
+  node_count = 0;
+  blocks = tree->blocks;
+  stack_depth = 0;
+
+  bounds = NULL;
+  children = NULL;
+  counts = NULL;
+
+  if (tree->node_count == 0) {
+    return;
+  }
+
+  // Every wide node absorbs at least one binary interior node
+  int max_nodes = 1;
+
+  for (int i = 0; i < tree->node_count; i++) {
+    if (tree->nodes[i].shape_count == 0) {
+      max_nodes++;
+    }
+  }
+
+  if (posix_memalign((void**) &bounds, 32,
+      max_nodes * 6 * width * sizeof(float))) {
+    fprintf(stderr, "Could not allocate %d wide tree nodes\n", max_nodes);
+    exit(EXIT_FAILURE);
+  }
+
+  children = (int*) malloc(max_nodes * width * sizeof(int));
+  counts = (unsigned short*) malloc(max_nodes * width *
+      sizeof(unsigned short));
+
+  collapse(tree->nodes, 0);
+  stack_depth = stack_needed(0);
+
+}
+
+// Builds the wide node for the binary subtree at index, by repeatedly opening
+// the interior child with the largest surface area until the node is full.
+// Returns the new node's index; nodes are laid out in depth-first order.
+int WideTree::collapse(LinearNode* nodes, int index) {
+
+  int wide_index = node_count++;
+  int lanes[WIDE_MAX_WIDTH];
+  int lane_count = 1;
+
+  lanes[0] = index;
+
+  while (true) {
+
+    int best_lane = -1;
+    float best_area = -1;
+
+    for (int l = 0; l < lane_count; l++) {
+
+      LinearNode* node = &nodes[lanes[l]];
+      float area = node->bbox.surface_area();
+
+      if (node->shape_count == 0 && area > best_area) {
+        best_lane = l;
+        best_area = area;
+      }
+
+    }
+
+    // Opening a node replaces it with its two children
+    if (best_lane == -1 || lane_count == width) {
+      break;
+    }
+
+    int opened = lanes[best_lane];
+    lanes[best_lane] = opened + 1;
+    lanes[lane_count++] = nodes[opened].offset;
+
+  }
+
+  float* node_bounds = bounds + wide_index * 6 * width;
+
+  for (int l = 0; l < width; l++) {
+
+    if (l >= lane_count) {
+
+      // Unused lanes get an inverted box that no ray can enter
+      node_bounds[0 * width + l] = numeric_limits<float>::infinity();
+      node_bounds[1 * width + l] = -1 * numeric_limits<float>::infinity();
+      node_bounds[2 * width + l] = numeric_limits<float>::infinity();
+      node_bounds[3 * width + l] = -1 * numeric_limits<float>::infinity();
+      node_bounds[4 * width + l] = numeric_limits<float>::infinity();
+      node_bounds[5 * width + l] = -1 * numeric_limits<float>::infinity();
+      children[wide_index * width + l] = -1;
+      counts[wide_index * width + l] = 0;
+      continue;
+
+    }
+
+    LinearNode* node = &nodes[lanes[l]];
+
+    node_bounds[0 * width + l] = node->bbox.x_min;
+    node_bounds[1 * width + l] = node->bbox.x_max;
+    node_bounds[2 * width + l] = node->bbox.y_min;
+    node_bounds[3 * width + l] = node->bbox.y_max;
+    node_bounds[4 * width + l] = node->bbox.z_min;
+    node_bounds[5 * width + l] = node->bbox.z_max;
+
+    if (node->shape_count > 0) {
+      children[wide_index * width + l] = node->offset;
+      counts[wide_index * width + l] = node->shape_count;
+    } else {
+      children[wide_index * width + l] = collapse(nodes, lanes[l]);
+      counts[wide_index * width + l] = 0;
+    }
+
+  }
+
+  return wide_index;
+
+}
+
+// Most entries a traversal of the subtree at node can have on its stack. A
+// node stacks all its interior children and takes one back straight away,
+// so the rest stay below whatever that child goes on to stack.
+int WideTree::stack_needed(int node) {
+
+  int interior = 0;
+  int deepest = 0;
+
+  for (int l = 0; l < width; l++) {
+
+    int child = children[node * width + l];
+
+    if (child >= 0 && counts[node * width + l] == 0) {
+      interior++;
+      deepest = max(deepest, stack_needed(child));
+    }
+
+  }
+
+  return max(interior, interior - 1 + deepest);
+
+}
+
+// Tests the ray against every child box of node at once
+int WideTree::intersect_node(int node, WideRay* ray, float* t_near) {
+
+  float* node_bounds = bounds + node * 6 * width;
+
+  if (width == 4) {
+    return intersect_lanes4(node_bounds, 4, ray, t_near);
+  }
+
+#ifdef WIDE_HAS_AVX2
+  static bool avx2 = __builtin_cpu_supports("avx2");
+
+  if (avx2) {
+    return intersect_lanes8(node_bounds, ray, t_near);
+  }
+#endif
+
+  return intersect_lanes4(node_bounds, 8, ray, t_near) |
+      (intersect_lanes4(node_bounds + 4, 8, ray, t_near + 4) << 4);
+
+}
+
+// Closest hit, as in BoundingTree::intersect_closest. Leaf children are
+// intersected as soon as their box is hit, and interior children are visited
+// nearest first.
+bool WideTree::intersect_closest(Ray ray, Primitive skip, HitRecord* hit) {
+
+  WideRay wide_ray(ray);
+
+  int stack[WIDE_STACK_SIZE];
+  float stack_t[WIDE_STACK_SIZE];
+  int stack_size = 0;
+
+  int current = 0;
+  float t_near[WIDE_MAX_WIDTH];
+
+  hit->shape = NULL;
+
+  if (node_count == 0) {
+    return false;
+  }
+
+  while (true) {
+
+    int mask = intersect_node(current, &wide_ray, t_near);
+
+    int order[WIDE_MAX_WIDTH];
+    int order_count = 0;
+
+    for (int l = 0; l < width; l++) {
+
+      if (!(mask & (1 << l))) {
+        continue;
+      }
+
+      int child = children[current * width + l];
+      int count = counts[current * width + l];
+
+      if (count == 0) {
+        order[order_count++] = l;
+        continue;
+      }
+
+      if (blocks->intersect_leaf(child, count, ray, skip, hit)) {
+        wide_ray.t_max = ray.t_max;
+      }
+
+    }
+
+    // Sort the interior children from far to near
+    for (int i = 1; i < order_count; i++) {
+      for (int j = i; j > 0 && t_near[order[j]] > t_near[order[j - 1]]; j--) {
+        swap(order[j], order[j - 1]);
+      }
+    }
+
+    // Stack the children from far to near, so the nearest is popped first
+    for (int i = 0; i < order_count; i++) {
+      if (t_near[order[i]] <= ray.t_max) {
+        stack[stack_size] = children[current * width + order[i]];
+        stack_t[stack_size] = t_near[order[i]];
+        stack_size++;
+      }
+    }
+
+    // Pop the next subtree that could still hold something closer
+    while (stack_size > 0 && stack_t[stack_size - 1] > ray.t_max) {
+      stack_size--;
+    }
+
+    if (stack_size == 0) {
+      break;
+    }
+
+    current = stack[--stack_size];
+
+  }
+
+  return hit->shape != NULL;
+
+}
+
+// Any-hit query, as in BoundingTree::occluded
+bool WideTree::occluded(Ray ray, Primitive skip) {
+
+  WideRay wide_ray(ray);
+
+  int stack[WIDE_STACK_SIZE];
+  int stack_size = 0;
+
+  int current = 0;
+  float t_near[WIDE_MAX_WIDTH];
+
+  if (node_count == 0) {
+    return false;
+  }
+
+  while (true) {
+
+    int mask = intersect_node(current, &wide_ray, t_near);
+
+    for (int l = 0; l < width; l++) {
+
+      if (!(mask & (1 << l))) {
+        continue;
+      }
+
+      int child = children[current * width + l];
+      int count = counts[current * width + l];
+
+      if (count == 0) {
+        stack[stack_size++] = child;
+        continue;
+      }
+
+      if (blocks->occluded_leaf(child, count, ray, skip)) {
+        return true;
+      }
+
+    }
+
+    if (stack_size == 0) {
+      break;
+    }
+
+    current = stack[--stack_size];
+
+  }
+
+  return false;
+
+}
+
+void WideTree::dispose() {
+
+  if (bounds) {
+    free(bounds);
+    free(children);
+    free(counts);
+  }
+
+  delete this;
+
+}